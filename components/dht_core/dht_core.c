@@ -0,0 +1,463 @@
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "nvs_flash.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_sntp.h"
+#include "dht_core.h"
+
+//WIFI
+#define EXAMPLE_ESP_WIFI_SSID CONFIG_ESP_WIFI_SSID
+#define EXAMPLE_ESP_WIFI_PASS CONFIG_ESP_WIFI_PASSWORD
+
+static const char *TAG = "core";
+
+/*Config section START*/
+
+/*
+Runtime configuration, persisted in NVS and editable through /api/v1/config. Compile-time values are only defaults.
+Fields are described by a table so NVS load/store, JSON output and validation share one definition.
+*/
+#define CONFIG_NVS_NAMESPACE "config"
+
+enum config_type{
+    CONFIG_TYPE_U32,
+    CONFIG_TYPE_STR,
+};
+
+struct config_field{
+    const char *key;        //NVS key and JSON member name (NVS keys are at most 15 chars)
+    enum config_type type;
+    size_t offset;
+    uint32_t min, max;      //value range for integers, length range for strings
+    bool live;              //applied without a reboot
+    bool secret;            //never reported back
+};
+
+static const struct config_field s_config_fields[] = {
+    { "sample_interval", CONFIG_TYPE_U32, offsetof(struct app_config, sample_interval_ms), 1000, 3600000, true, false },
+    { "dht_pin",         CONFIG_TYPE_U32, offsetof(struct app_config, dht_pin), 0, 33, true, false },
+    { "history_depth",   CONFIG_TYPE_U32, offsetof(struct app_config, history_depth), 1, CONFIG_HISTORY_MAX_DEPTH, true, false },
+    { "wifi_ssid",       CONFIG_TYPE_STR, offsetof(struct app_config, wifi_ssid), 1, 32, false, false },
+    { "wifi_password",   CONFIG_TYPE_STR, offsetof(struct app_config, wifi_password), 0, 64, false, true },
+};
+#define CONFIG_FIELD_COUNT (sizeof(s_config_fields) / sizeof(s_config_fields[0]))
+
+static SemaphoreHandle_t s_config_lock;
+static StaticSemaphore_t s_config_lock_buf;
+static struct app_config s_config = {
+    .sample_interval_ms = CONFIG_SAMPLE_INTERVAL_MS,
+    .dht_pin = DHT11_PIN,
+    .history_depth = CONFIG_HISTORY_MAX_DEPTH,
+    .wifi_ssid = EXAMPLE_ESP_WIFI_SSID,
+    .wifi_password = EXAMPLE_ESP_WIFI_PASS,
+};
+
+void config_get(struct app_config *out)
+{
+    xSemaphoreTake(s_config_lock, portMAX_DELAY);
+    *out = s_config;
+    xSemaphoreGive(s_config_lock);
+}
+
+/*Load stored overrides on top of the compile-time defaults, needs NVS*/
+void config_init(void)
+{
+    s_config_lock = xSemaphoreCreateMutexStatic(&s_config_lock_buf);
+    nvs_handle_t nvs;
+    if(nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return;
+    for(int i = 0; i < CONFIG_FIELD_COUNT; i++)
+    {
+        const struct config_field *f = &s_config_fields[i];
+        void *value = (char *)&s_config + f->offset;
+        if(f->type == CONFIG_TYPE_U32)
+        {
+            uint32_t v;
+            //values outside the current range (eg. after a Kconfig change) fall back to the default
+            if(nvs_get_u32(nvs, f->key, &v) == ESP_OK && v >= f->min && v <= f->max)
+                *(uint32_t *)value = v;
+        }
+        else
+        {
+            char buf[65];
+            size_t len = sizeof(buf);
+            if(nvs_get_str(nvs, f->key, buf, &len) == ESP_OK && len - 1 >= f->min && len - 1 <= f->max)
+                strcpy(value, buf);
+        }
+    }
+    nvs_close(nvs);
+}
+
+/*
+Validate every member of a JSON object against the field table, then store and apply them all or none.
+Returns ESP_ERR_INVALID_ARG with err naming the offending member. *reboot is set when a changed field is not live.
+*/
+esp_err_t config_update(const cJSON *json, char *err, size_t err_len, bool *reboot)
+{
+    struct app_config next;
+    config_get(&next);
+    *reboot = false;
+
+    if(!cJSON_IsObject(json))
+    {
+        snprintf(err, err_len, "expected a JSON object");
+        return ESP_ERR_INVALID_ARG;
+    }
+    const cJSON *item;
+    cJSON_ArrayForEach(item, json)
+    {
+        const struct config_field *f = NULL;
+        for(int i = 0; i < CONFIG_FIELD_COUNT; i++)
+            if(strcmp(item->string, s_config_fields[i].key) == 0)
+                f = &s_config_fields[i];
+        if(f == NULL)
+        {
+            snprintf(err, err_len, "unknown field %s", item->string);
+            return ESP_ERR_INVALID_ARG;
+        }
+        void *value = (char *)&next + f->offset;
+        if(f->type == CONFIG_TYPE_U32)
+        {
+            if(!cJSON_IsNumber(item) || item->valuedouble < f->min || item->valuedouble > f->max || item->valuedouble != (uint32_t)item->valuedouble)
+            {
+                snprintf(err, err_len, "%s must be an integer in [%u, %u]", f->key, f->min, f->max);
+                return ESP_ERR_INVALID_ARG;
+            }
+            *(uint32_t *)value = item->valuedouble;
+        }
+        else
+        {
+            size_t len = cJSON_IsString(item) ? strlen(item->valuestring) : 0;
+            if(!cJSON_IsString(item) || len < f->min || len > f->max)
+            {
+                snprintf(err, err_len, "%s must be a string of %u to %u characters", f->key, f->min, f->max);
+                return ESP_ERR_INVALID_ARG;
+            }
+            strcpy(value, item->valuestring);
+        }
+        if(!f->live)
+            *reboot = true;
+    }
+    if(!GPIO_IS_VALID_OUTPUT_GPIO(next.dht_pin))
+    {
+        snprintf(err, err_len, "dht_pin %u cannot drive the data line", next.dht_pin);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t nvs;
+    esp_err_t ret = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if(ret != ESP_OK)
+    {
+        snprintf(err, err_len, "nvs: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    for(int i = 0; i < CONFIG_FIELD_COUNT && ret == ESP_OK; i++)
+    {
+        const struct config_field *f = &s_config_fields[i];
+        const void *value = (const char *)&next + f->offset;
+        if(f->type == CONFIG_TYPE_U32)
+            ret = nvs_set_u32(nvs, f->key, *(const uint32_t *)value);
+        else
+            ret = nvs_set_str(nvs, f->key, value);
+    }
+    if(ret == ESP_OK)
+        ret = nvs_commit(nvs);
+    nvs_close(nvs);
+    if(ret != ESP_OK)
+    {
+        snprintf(err, err_len, "nvs: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    //live fields are picked up by their owners (sampler, history) on their next pass
+    xSemaphoreTake(s_config_lock, portMAX_DELAY);
+    s_config = next;
+    xSemaphoreGive(s_config_lock);
+    return ESP_OK;
+}
+
+/*Render the config as a JSON object, secrets omitted. Returns the length snprintf would have written*/
+int config_format_json(char *out, size_t len)
+{
+    return config_format_json_fields(out, len, FIELDS_MASK(CONFIG_FIELD_COUNT));
+}
+
+/*Only the fields whose bit is set in mask, see config_fields_parse*/
+int config_format_json_fields(char *out, size_t len, uint32_t mask)
+{
+    struct app_config cfg;
+    config_get(&cfg);
+    int n = snprintf(out, len, "{");
+    for(uint32_t m = mask; m; m &= m - 1)
+    {
+        const struct config_field *f = &s_config_fields[__builtin_ctz(m)];
+        const void *value = (const char *)&cfg + f->offset;
+        if(f->secret)
+            continue;
+        if(f->type == CONFIG_TYPE_U32)
+            n += snprintf(out + MIN(n, len), len - MIN(n, len), "%s\"%s\":%u", n > 1 ? "," : "", f->key, *(const uint32_t *)value);
+        else
+            n += snprintf(out + MIN(n, len), len - MIN(n, len), "%s\"%s\":\"%s\"", n > 1 ? "," : "", f->key, (const char *)value);
+    }
+    n += snprintf(out + MIN(n, len), len - MIN(n, len), "}");
+    return n;
+}
+
+bool config_fields_parse(const char *list, uint32_t *mask)
+{
+    return fields_parse(list, s_config_fields, sizeof(s_config_fields[0]), CONFIG_FIELD_COUNT, mask);
+}
+/*Config section END*/
+
+
+/*Clock section START*/
+
+/*
+Samples are stamped with the monotonic esp_timer clock and mapped to wall-clock time here:
+wall = mono + offset + (mono - sync_mono) * drift. SNTP (optional) sets the offset and every later sync
+measures how far the mapping ran off to estimate the crystal drift. The drift estimate and sync state live
+in RTC memory so a soft reset keeps them, and in NVS so a cold boot starts from the last known time and drift.
+*/
+#define CLOCK_RTC_MAGIC      0x434c4b31 //"CLK1"
+#define CLOCK_NVS_NAMESPACE  "clock"
+#define CLOCK_MAX_DRIFT_PPB  500000  //+-500 ppm, anything larger is a step, not drift
+#define CLOCK_MIN_DRIFT_SPAN_US (10 * 60 * 1000000LL)
+
+struct clock_rtc_state{
+    uint32_t magic;
+    int32_t drift_ppb;
+    uint8_t synced;
+};
+
+static RTC_NOINIT_ATTR struct clock_rtc_state s_clock_rtc;
+static portMUX_TYPE s_clock_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_clock_offset_us;
+static int64_t s_clock_sync_mono_us;
+static int32_t s_clock_drift_ppb;
+static bool s_clock_synced;
+static nvs_handle_t s_clock_nvs;   //kept open, nvs_open allocates
+
+static int64_t system_time_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+int64_t clock_wall_us(int64_t mono_us)
+{
+    portENTER_CRITICAL(&s_clock_mux);
+    //scaled through ms so elapsed * ppb cannot overflow, however long since the sync
+    int64_t wall = mono_us + s_clock_offset_us + (mono_us - s_clock_sync_mono_us) / 1000 * s_clock_drift_ppb / 1000000;
+    portEXIT_CRITICAL(&s_clock_mux);
+    return wall;
+}
+
+bool clock_is_synced(void)
+{
+    return s_clock_synced;
+}
+
+int32_t clock_drift_ppb(void)
+{
+    return s_clock_drift_ppb;
+}
+
+/*esp_timer time of the last sync or boot, a new value means the mapping was reset*/
+int64_t clock_sync_mono_us(void)
+{
+    portENTER_CRITICAL(&s_clock_mux);
+    int64_t mono = s_clock_sync_mono_us;
+    portEXIT_CRITICAL(&s_clock_mux);
+    return mono;
+}
+
+/*Save what a cold boot needs: the drift estimate and a lower bound for the current time*/
+void clock_persist(void)
+{
+    if(s_clock_nvs == 0)
+        return;
+    nvs_set_i32(s_clock_nvs, "drift_ppb", s_clock_drift_ppb);
+    nvs_set_i64(s_clock_nvs, "wall_us", clock_wall_us(esp_timer_get_time()));
+    nvs_commit(s_clock_nvs);
+}
+
+#if CONFIG_SNTP_ENABLE
+static void clock_sync_cb(struct timeval *tv)
+{
+    int64_t mono = esp_timer_get_time();
+    int64_t actual = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    int64_t error = actual - clock_wall_us(mono);
+
+    portENTER_CRITICAL(&s_clock_mux);
+    int64_t span = mono - s_clock_sync_mono_us;
+    //refine the drift from how far the mapping ran off since the previous sync; an error beyond what twice the
+    //largest drift explains is a step (eg. the RTC lost power) and leaves the estimate alone
+    int64_t span_ms = span / 1000;
+    int64_t step_us = span_ms * (2 * CLOCK_MAX_DRIFT_PPB / 1000) / 1000;
+    if(s_clock_synced && span >= CLOCK_MIN_DRIFT_SPAN_US && llabs(error) <= step_us)
+    {
+        int64_t drift = s_clock_drift_ppb + error * 1000000 / span_ms;
+        s_clock_drift_ppb = MIN(MAX(drift, -CLOCK_MAX_DRIFT_PPB), CLOCK_MAX_DRIFT_PPB);
+    }
+    s_clock_offset_us = actual - mono;
+    s_clock_sync_mono_us = mono;
+    s_clock_synced = true;
+    portEXIT_CRITICAL(&s_clock_mux);
+
+    s_clock_rtc.drift_ppb = s_clock_drift_ppb;
+    s_clock_rtc.synced = 1;
+    ESP_LOGI(TAG, "time synced, error %lld us, drift %d ppb", error, s_clock_drift_ppb);
+    clock_persist();
+}
+#endif
+
+/*Restore the wall-clock mapping, needs NVS*/
+void clock_init(void)
+{
+    int64_t mono = esp_timer_get_time();
+    if(nvs_open(CLOCK_NVS_NAMESPACE, NVS_READWRITE, &s_clock_nvs) != ESP_OK)
+        s_clock_nvs = 0;
+    if(s_clock_rtc.magic == CLOCK_RTC_MAGIC)
+    {
+        //soft reset: the RTC timer kept the system time running
+        s_clock_drift_ppb = s_clock_rtc.drift_ppb;
+        s_clock_synced = s_clock_rtc.synced;
+    }
+    else
+    {
+        //cold boot: restart from the last persisted time, still flagged unsynced
+        int64_t wall_us = 0;
+        memset(&s_clock_rtc, 0, sizeof(s_clock_rtc));
+        s_clock_rtc.magic = CLOCK_RTC_MAGIC;
+        if(s_clock_nvs != 0)
+        {
+            nvs_get_i32(s_clock_nvs, "drift_ppb", &s_clock_drift_ppb);
+            nvs_get_i64(s_clock_nvs, "wall_us", &wall_us);
+        }
+        if(wall_us > system_time_us())
+        {
+            struct timeval tv = { .tv_sec = wall_us / 1000000, .tv_usec = wall_us % 1000000 };
+            settimeofday(&tv, NULL);
+        }
+        s_clock_rtc.drift_ppb = s_clock_drift_ppb;
+    }
+    s_clock_offset_us = system_time_us() - mono;
+    s_clock_sync_mono_us = mono;
+}
+
+void clock_start_sntp(void)
+{
+#if CONFIG_SNTP_ENABLE
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, CONFIG_SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(clock_sync_cb);
+    sntp_init();
+#endif
+}
+/*Clock section END*/
+
+
+/*Fields section START*/
+
+/*
+?fields=a,b projection for the JSON routes. The list is parsed once into a mask over the route's field table, and
+serializers walk only the set bits, so a field nobody asked for is never formatted. Every table starts its entries
+with the field name, which is all fields_parse looks at, so the config table is parsed the same way.
+*/
+bool fields_parse(const char *list, const void *table, size_t stride, int count, uint32_t *mask)
+{
+    *mask = 0;
+    while(*list)
+    {
+        //a comma may arrive percent-encoded
+        size_t len = strcspn(list, ",%");
+        int i = 0;
+        for(; i < count; i++)
+        {
+            const char *name = *(const char *const *)((const char *)table + i * stride);
+            if(strncmp(name, list, len) == 0 && name[len] == 0)
+                break;
+        }
+        if(i == count)
+            return false;
+        *mask |= 1u << i;
+        list += len;
+        if(strncasecmp(list, "%2c", 3) == 0)
+            list += 3;
+        else if(*list == ',')
+            list++;
+        else if(*list)
+            return false;
+    }
+    return *mask != 0;
+}
+
+/*{"name":value,...} of the selected fields in table order; mask must not select past the end of table*/
+int fields_format_json(char *out, size_t len, const struct json_field *table, uint32_t mask, const void *rec)
+{
+    int n = 0;
+    const char *sep = "{";
+    for(uint32_t m = mask; m; m &= m - 1)
+    {
+        const struct json_field *f = &table[__builtin_ctz(m)];
+        APPEND(out, len, n, "%s%s", sep, f->key);
+        n += f->format(out + MIN((size_t)n, len), len - MIN((size_t)n, len), rec);
+        sep = ",";
+    }
+    APPEND(out, len, n, mask ? "}" : "{}");
+    return n;
+}
+
+/*
+Sample fields for history rows, /api/v1/current and /api/v1/sensors/{id}; rec is a struct data. A record that was
+never sampled (mono_us 0) has null readings.
+*/
+static int sample_format_id(char *out, size_t len, const void *rec)
+{
+    const struct data *d = rec;
+    return d->sensor == FUSION_SENSOR_ID ? snprintf(out, len, "\"fused\"") : snprintf(out, len, "%u", d->sensor);
+}
+
+static int sample_format_status(char *out, size_t len, const void *rec)
+{
+    return snprintf(out, len, "%u", ((const struct data *)rec)->status);
+}
+
+static int sample_format_t(char *out, size_t len, const void *rec)
+{
+    const struct data *d = rec;
+    return d->mono_us ? snprintf(out, len, "%lld", (long long)(clock_wall_us(d->mono_us) / 1000)) : snprintf(out, len, "null");
+}
+
+static int sample_format_temperature(char *out, size_t len, const void *rec)
+{
+    const struct data *d = rec;
+    return d->mono_us ? snprintf(out, len, TENTHS_FMT, TENTHS_ARGS(d->temperature)) : snprintf(out, len, "null");
+}
+
+static int sample_format_humidity(char *out, size_t len, const void *rec)
+{
+    const struct data *d = rec;
+    return d->mono_us ? snprintf(out, len, TENTHS_FMT, TENTHS_ARGS(d->humidity)) : snprintf(out, len, "null");
+}
+
+const struct json_field sample_fields[SAMPLE_FIELDS] = {
+    [SAMPLE_FIELD_ID]          = JSON_FIELD("id", sample_format_id),
+    [SAMPLE_FIELD_STATUS]      = JSON_FIELD("status", sample_format_status),
+    [SAMPLE_FIELD_T]           = JSON_FIELD("t", sample_format_t),
+    [SAMPLE_FIELD_TEMPERATURE] = JSON_FIELD("temperature", sample_format_temperature),
+    [SAMPLE_FIELD_HUMIDITY]    = JSON_FIELD("humidity", sample_format_humidity),
+};
+
+bool sample_fields_parse(const char *list, uint32_t *mask)
+{
+    return fields_parse(list, sample_fields, sizeof(sample_fields[0]), SAMPLE_FIELDS, mask);
+}
+/*Fields section END*/
@@ -0,0 +1,84 @@
+/*
+Types and services every component shares: the sample record, printf helpers, the runtime configuration store
+and the wall clock.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "cJSON.h"
+#include "sdkconfig.h"
+
+//PINS (defaults, the runtime values live in the config store)
+#define DHT11_PIN     4
+#define BLUELED_PIN 16
+
+//DHT11 status codes stored in struct data
+#define DHT_OK            0
+#define DHT_ERR_CHECKSUM  1
+#define DHT_ERR_TIMEOUT   2
+#define DHT_ERR_NO_DATA   3
+#define FUSION_SENSOR_ID 0xffff
+#define LOADGEN_SENSOR_BASE 0x100
+
+/* Readings are kept as 16-bit fixed-point tenths (235 means 23.5) so the decimal bytes survive without floats */
+struct data{
+    int64_t mono_us;     //esp_timer time the read started, map with clock_wall_us()
+    int16_t temperature; //tenths of a degree C
+    uint16_t humidity;   //tenths of a percent RH
+    uint8_t status;
+    uint16_t sensor;     //index of the physical sensor, FUSION_SENSOR_ID for the fused one, LOADGEN_SENSOR_BASE + n synthetic
+};
+
+/* printf helpers for tenths values, eg. printf("T=" TENTHS_FMT, TENTHS_ARGS(-5)) prints "T=-0.5" */
+#define TENTHS_FMT "%s%d.%d"
+#define TENTHS_ARGS(v) ((v) < 0 ? "-" : ""), abs(v) / 10, abs(v) % 10
+/* snprintf into out at n and advance n, which keeps counting past len like snprintf does */
+#define APPEND(out, len, n, ...) ((n) += snprintf((out) + MIN((size_t)(n), (len)), (len) - MIN((size_t)(n), (len)), __VA_ARGS__))
+
+/*Config section*/
+struct app_config{
+    uint32_t sample_interval_ms;
+    uint32_t dht_pin;
+    uint32_t history_depth;
+    char wifi_ssid[33];
+    char wifi_password[65];
+};
+
+void config_init(void);
+void config_get(struct app_config *out);
+esp_err_t config_update(const cJSON *json, char *err, size_t err_len, bool *reboot);
+int config_format_json(char *out, size_t len);
+int config_format_json_fields(char *out, size_t len, uint32_t mask);
+bool config_fields_parse(const char *list, uint32_t *mask);
+
+/*Clock section*/
+void clock_init(void);
+void clock_start_sntp(void);
+int64_t clock_wall_us(int64_t mono_us);
+bool clock_is_synced(void);
+void clock_persist(void);
+int32_t clock_drift_ppb(void);
+int64_t clock_sync_mono_us(void);
+
+/*Fields section*/
+/*Bit i of a field mask selects entry i of a field table of at most 32*/
+#define FIELDS_MASK(count) ((1u << (count)) - 1)
+
+struct json_field{
+    const char *name;     //first member, see fields_parse
+    const char *key;      //"\"name\":"
+    int (*format)(char *out, size_t len, const void *rec);    //the value, snprintf semantics
+};
+#define JSON_FIELD(name, format) { name, "\"" name "\":", format }
+
+enum sample_field{ SAMPLE_FIELD_ID, SAMPLE_FIELD_STATUS, SAMPLE_FIELD_T, SAMPLE_FIELD_TEMPERATURE, SAMPLE_FIELD_HUMIDITY, SAMPLE_FIELDS };
+extern const struct json_field sample_fields[SAMPLE_FIELDS];
+
+bool fields_parse(const char *list, const void *table, size_t stride, int count, uint32_t *mask);
+int fields_format_json(char *out, size_t len, const struct json_field *table, uint32_t mask, const void *rec);
+bool sample_fields_parse(const char *list, uint32_t *mask);
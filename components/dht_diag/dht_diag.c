@@ -0,0 +1,620 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_console.h"
+#include "dht_sensor.h"
+#include "dht_sampler.h"
+#include "dht_diag.h"
+#if CONFIG_DHT_STORAGE_ENABLE
+#include "dht_storage.h"
+#endif
+#if CONFIG_DHT_EXPORTERS_ENABLE
+#include "dht_exporters.h"
+#endif
+#if CONFIG_DHT_WEB_ENABLE
+#include "dht_web.h"
+#endif
+#if CONFIG_FASTPATH_ENABLE
+#include "lwip/sockets.h"
+#endif
+
+#define BUFFERSIZE CONFIG_RESPONSE_BUFFER_SIZE
+
+/*Diagnostics section START*/
+
+/*A short trace of recent sensor transactions, read by the debug formatters below*/
+#define TRACE_DEPTH 16
+
+struct sensor_trace{
+    int64_t mono_us;
+    uint32_t duration_us;
+    uint8_t raw[5];
+    uint8_t status;
+};
+
+static struct sensor_trace s_trace[TRACE_DEPTH];
+static uint32_t s_trace_next;
+static portMUX_TYPE s_trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*Called by the sampler after every read*/
+void diag_record_read(const struct data *sample, uint32_t duration_us)
+{
+    struct sensor_trace t = { .mono_us = sample->mono_us, .duration_us = duration_us, .status = sample->status };
+    dht_last_raw(t.raw);
+    portENTER_CRITICAL(&s_trace_mux);
+    s_trace[s_trace_next++ % TRACE_DEPTH] = t;
+    portEXIT_CRITICAL(&s_trace_mux);
+}
+
+#if CONFIG_HEAP_AUDIT
+/*
+Steady state is meant to be heap free. With HEAP_AUDIT the allocator entry points are wrapped at link time
+(see components/dht_diag/CMakeLists.txt) and every allocation after heap_audit_arm() is counted per calling task.
+*/
+#define HEAP_AUDIT_TASKS 8
+
+struct heap_audit_task{
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t count;
+};
+
+static bool s_heap_audit_armed;
+static uint32_t s_heap_audit_total;
+static uint32_t s_heap_audit_isr;
+static struct heap_audit_task s_heap_audit_tasks[HEAP_AUDIT_TASKS];
+static portMUX_TYPE s_heap_audit_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_heap_caps_malloc(size_t size, uint32_t caps);
+void *__real_heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+
+static void heap_audit_note(void)
+{
+    if(!s_heap_audit_armed)
+        return;
+    if(xPortInIsrContext())
+    {
+        __atomic_fetch_add(&s_heap_audit_isr, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    const char *name = pcTaskGetTaskName(NULL);
+    portENTER_CRITICAL(&s_heap_audit_mux);
+    s_heap_audit_total++;
+    for(int i = 0; i < HEAP_AUDIT_TASKS; i++)
+    {
+        struct heap_audit_task *t = &s_heap_audit_tasks[i];
+        if(t->count == 0)
+            strlcpy(t->name, name, sizeof(t->name));
+        if(strcmp(t->name, name) == 0)
+        {
+            t->count++;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_heap_audit_mux);
+}
+
+void *__wrap_malloc(size_t size)
+{
+    heap_audit_note();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    heap_audit_note();
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    heap_audit_note();
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_heap_caps_malloc(size_t size, uint32_t caps)
+{
+    heap_audit_note();
+    return __real_heap_caps_malloc(size, caps);
+}
+
+void *__wrap_heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    heap_audit_note();
+    return __real_heap_caps_calloc(n, size, caps);
+}
+
+/*Called once init is done, from here on every allocation is reported*/
+void heap_audit_arm(void)
+{
+    s_heap_audit_armed = true;
+}
+#endif
+/*Diagnostics section END*/
+
+
+/*Debug formatter section START*/
+
+/*
+JSON renderers shared by the /api/v1/debug/ endpoints and the UART console. Each writes at most len bytes
+(always terminated) and returns the length it would have needed, like snprintf. Components own the renderers for
+their state, this table collects the ones that are built in.
+*/
+int debug_format_trace(char *out, size_t len)
+{
+    struct sensor_trace trace[TRACE_DEPTH];
+    portENTER_CRITICAL(&s_trace_mux);
+    uint32_t next = s_trace_next;
+    memcpy(trace, s_trace, sizeof(trace));
+    portEXIT_CRITICAL(&s_trace_mux);
+
+    int n = 0;
+    APPEND(out, len, n, "{\"trace\":[");
+    for(uint32_t i = next - MIN(next, TRACE_DEPTH); i < next; i++)
+    {
+        const struct sensor_trace *t = &trace[i % TRACE_DEPTH];
+        APPEND(out, len, n, "%s{\"t_ms\":%lld,\"us\":%u,\"raw\":\"%02x%02x%02x%02x%02x\",\"status\":%u}",
+               i == next - MIN(next, TRACE_DEPTH) ? "" : ",", t->mono_us / 1000, t->duration_us,
+               t->raw[0], t->raw[1], t->raw[2], t->raw[3], t->raw[4], t->status);
+    }
+    APPEND(out, len, n, "]}");
+    return n;
+}
+
+/*Allocations made after init, only counted with HEAP_AUDIT*/
+int debug_format_heap(char *out, size_t len)
+{
+    int n = 0;
+    APPEND(out, len, n, "{\"free\":%u,\"min_free\":%u,\"largest_block\":%u,", esp_get_free_heap_size(),
+           esp_get_minimum_free_heap_size(), (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#if CONFIG_HEAP_AUDIT
+    struct heap_audit_task tasks[HEAP_AUDIT_TASKS];
+    portENTER_CRITICAL(&s_heap_audit_mux);
+    uint32_t total = s_heap_audit_total;
+    memcpy(tasks, s_heap_audit_tasks, sizeof(tasks));
+    portEXIT_CRITICAL(&s_heap_audit_mux);
+    APPEND(out, len, n, "\"audit\":{\"armed\":%s,\"allocs_after_init\":%u,\"from_isr\":%u,\"tasks\":{",
+           s_heap_audit_armed ? "true" : "false", total, s_heap_audit_isr);
+    for(int i = 0; i < HEAP_AUDIT_TASKS && tasks[i].count; i++)
+        APPEND(out, len, n, "%s\"%s\":%u", i ? "," : "", tasks[i].name, tasks[i].count);
+    APPEND(out, len, n, "}}}");
+#else
+    APPEND(out, len, n, "\"audit\":null}");
+#endif
+    return n;
+}
+
+static const struct debug_formatter s_debug_formatters[] = {
+    { "stats",  "Counters, heap, history, flash log and clock state", debug_format_stats },
+    { "trace",  "Timing and raw bytes of the last sensor transactions", debug_format_trace },
+    { "sensor", "Sensor pin, type and latest reading", debug_format_sensor },
+    { "ring",   "Newest samples in the RAM history ring", debug_format_ring },
+    { "heap",   "Heap state and allocations made after init (HEAP_AUDIT)", debug_format_heap },
+#if CONFIG_DHT_WEB_ENABLE
+    { "arena",  "Request arena pool usage and high-water marks", debug_format_arena },
+#endif
+    { "config", "Runtime configuration", config_format_json },
+    { "schedule", "Learned scrape phase, sampler alignment and served data age", debug_format_schedule },
+#if CONFIG_DHT_WEB_ENABLE
+    { "httpd",  "Handler latency of the API and bulk server instances", debug_format_httpd },
+#endif
+#if CONFIG_STREAM_ENABLE
+    { "stream", "Push stream frames per second, bytes per frame and latency added by coalescing", debug_format_stream },
+#endif
+#if CONFIG_DHT_WEB_ENABLE && CONFIG_QCACHE_SIZE > 0
+    { "qcache", "Query cache hit rate, invalidations, evictions and cached responses", debug_format_qcache },
+#endif
+#if CONFIG_DHT_FUSION
+    { "fusion", "Per-sensor readings, failures, rejections and disagreement with the fused value", debug_format_fusion },
+#endif
+    { "power",  "Sensor supply gating, powered time and estimated energy per sample", debug_format_power },
+#if CONFIG_FASTPATH_ENABLE
+    { "fastpath", "Raw socket responder requests, refusals and service time", debug_format_fastpath },
+#endif
+#if CONFIG_PUSH_ENABLE
+    { "push",   "Push link weakness, batch size, interval, uploads and failures", debug_format_push },
+#endif
+#if CONFIG_FLASHLOG_COMPACT
+    { "compactor", "Raw and rollup tier occupancy, compaction jobs and step time", debug_format_compactor },
+#endif
+#if CONFIG_HTTPS_ENABLE
+    { "tls",    "TLS handshakes, session ticket resumption and handshake time", debug_format_tls },
+#endif
+};
+#define DEBUG_FORMATTER_COUNT (sizeof(s_debug_formatters) / sizeof(s_debug_formatters[0]))
+
+const struct debug_formatter *debug_find(const char *name)
+{
+    for(int i = 0; i < DEBUG_FORMATTER_COUNT; i++)
+        if(strcmp(s_debug_formatters[i].name, name) == 0)
+            return &s_debug_formatters[i];
+    return NULL;
+}
+/*Debug formatter section END*/
+
+
+/*Console section START*/
+#if CONFIG_CONSOLE_ENABLE
+
+/*UART REPL for when the network is down. Output comes from the same formatters as /api/v1/debug/*/
+static char s_console_buf[BUFFERSIZE];
+
+static int console_print(const struct debug_formatter *f)
+{
+    int n = f->format(s_console_buf, sizeof(s_console_buf));
+    printf("%s\n", s_console_buf);
+    if(n >= sizeof(s_console_buf))
+        printf("(truncated, %d bytes)\n", n);
+    return 0;
+}
+
+/*Handles every formatter command, the command name selects the formatter*/
+static int console_debug_cmd(int argc, char **argv)
+{
+    return console_print(debug_find(argv[0]));
+}
+
+/*config [set <key> <value>]: values are parsed as JSON, so strings need quotes*/
+static int console_config_cmd(int argc, char **argv)
+{
+    if(argc == 4 && strcmp(argv[1], "set") == 0)
+    {
+        cJSON *json = cJSON_CreateObject();
+        cJSON *value = cJSON_Parse(argv[3]);
+        if(value == NULL)
+            value = cJSON_CreateString(argv[3]);
+        cJSON_AddItemToObject(json, argv[2], value);
+        char err[96];
+        bool reboot;
+        esp_err_t ret = config_update(json, err, sizeof(err), &reboot);
+        cJSON_Delete(json);
+        if(ret != ESP_OK)
+        {
+            printf("error: %s\n", err);
+            return 1;
+        }
+        if(reboot)
+            printf("stored, applied after reboot\n");
+    }
+    else if(argc != 1)
+    {
+        printf("usage: config [set <key> <value>]\n");
+        return 1;
+    }
+    return console_print(debug_find("config"));
+}
+
+#if CONFIG_FASTPATH_ENABLE && CONFIG_DHT_WEB_ENABLE
+/*CPU time a task has used so far in run time stats units, us with the esp_timer clock*/
+static uint32_t console_task_runtime(TaskHandle_t task)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    TaskStatus_t status;
+    if(task == NULL)
+        return 0;
+    vTaskGetInfo(task, &status, pdFALSE, eRunning);
+    return status.ulRunTimeCounter;
+#else
+    return 0;
+#endif
+}
+
+/*Send requests GETs over one keep-alive loopback connection and read each response; returns the wall time in us, or -1*/
+static int64_t console_bench_http_run(uint16_t port, const char *path, int requests)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    struct timeval timeout = { .tv_sec = 2 };
+    int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if(fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    char req[64];
+    int req_len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: bench\r\n\r\n", path);
+
+    int64_t start = esp_timer_get_time();
+    int done = 0;
+    for(; done < requests; done++)
+    {
+        if(send(fd, req, req_len, 0) != req_len)
+            break;
+        //keep the header until Content-Length is known, then only count bytes
+        int got = 0, want = -1;
+        while(want < 0 || got < want)
+        {
+            int off = want < 0 ? got : 0;
+            int n = recv(fd, s_console_buf + off, sizeof(s_console_buf) - 1 - off, 0);
+            if(n <= 0)
+                break;
+            got += n;
+            if(want >= 0)
+                continue;
+            s_console_buf[got] = 0;
+            char *end = strstr(s_console_buf, "\r\n\r\n");
+            char *length = strstr(s_console_buf, "Content-Length:");
+            if(end && length)
+                want = end + 4 - s_console_buf + atoi(length + 15);
+        }
+        if(want < 0 || got < want)
+            break;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    close(fd);
+    return done == requests ? elapsed : -1;
+}
+
+/*bench http: the same snapshot documents through httpd and through the fast path, over loopback*/
+static void console_bench_http(int requests)
+{
+    const struct { const char *name; uint16_t port; } servers[] = {
+        { "httpd", HTTPD_API_PORT },
+        { "fastpath", CONFIG_FASTPATH_PORT },
+    };
+    static const char *const paths[] = { "/metrics", "/api/v1/current" };
+    for(int i = 0; i < sizeof(servers) / sizeof(servers[0]); i++)
+    {
+#if CONFIG_HTTPS_ENABLE
+        if(servers[i].port == HTTPD_API_PORT)
+        {
+            printf("httpd serves HTTPS, skipped\n");
+            continue;
+        }
+#endif
+        for(int j = 0; j < sizeof(paths) / sizeof(paths[0]); j++)
+        {
+            //the httpd task is only known once it has served a request, so warm up first
+            console_bench_http_run(servers[i].port, paths[j], 1);
+            TaskHandle_t task = i == 0 ? httpd_task(HTTPD_API) : fastpath_task_handle();
+            uint32_t cpu = console_task_runtime(task);
+            int64_t elapsed = console_bench_http_run(servers[i].port, paths[j], requests);
+            cpu = console_task_runtime(task) - cpu;
+            if(elapsed <= 0)
+            {
+                printf("%-8s %-16s failed\n", servers[i].name, paths[j]);
+                continue;
+            }
+            printf("%-8s %-16s %6lld req/s %6lld us/req %6u us/req cpu\n", servers[i].name, paths[j],
+                   requests * 1000000LL / elapsed, elapsed / requests, cpu / requests);
+        }
+    }
+    printf("cpu is the server task alone, lwIP and this client run on the same chip\n");
+}
+#endif
+
+/*bench [iterations]: time each formatter and the API router, the numbers are what a request costs on the httpd task*/
+static int console_bench_cmd(int argc, char **argv)
+{
+#if CONFIG_FASTPATH_ENABLE && CONFIG_DHT_WEB_ENABLE
+    if(argc > 1 && strcmp(argv[1], "http") == 0)
+    {
+        int requests = argc > 2 ? atoi(argv[2]) : 200;
+        console_bench_http(requests > 0 ? requests : 200);
+        return 0;
+    }
+#endif
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+    if(iterations <= 0)
+        iterations = 100;
+#if CONFIG_DHT_WEB_ENABLE
+    router_bench(iterations * 100);
+#endif
+    for(int i = 0; i < DEBUG_FORMATTER_COUNT; i++)
+    {
+        const struct debug_formatter *f = &s_debug_formatters[i];
+        int n = 0;
+        int64_t start = esp_timer_get_time();
+        for(int j = 0; j < iterations; j++)
+            n = f->format(s_console_buf, sizeof(s_console_buf));
+        int64_t elapsed = esp_timer_get_time() - start;
+        printf("%-8s %6d bytes %8lld us/op\n", f->name, n, elapsed / iterations);
+    }
+    return 0;
+}
+
+#if CONFIG_FLASHLOG_FAULT_INJECT
+#if CONFIG_FLASHLOG_COMPACT
+#define POWERCUT_POINTS "erase|header|record|rollup-erase|rollup-header|rollup-record"
+#else
+#define POWERCUT_POINTS "erase|header|record"
+#endif
+
+static int console_powercut_cmd(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        struct flashlog_cut_report last;
+        flashlog_cut_last(&last);
+        printf("last cut: %s, %s, %u torn records, recovery %u us\n", flashlog_cut_name(last.cut),
+               last.cut == FLASHLOG_CUT_NONE ? "-" : last.ok ? "ok" : "FAILED", last.torn, last.recovery_us);
+        return 0;
+    }
+    for(int i = FLASHLOG_CUT_ERASE; i <= FLASHLOG_CUTS; i++)
+    {
+        if(strcmp(argv[1], i < FLASHLOG_CUTS ? flashlog_cut_name(i) : "sweep") == 0)
+        {
+            flashlog_cut_arm(i);
+            printf("armed, the chip restarts at the next %s write\n", i < FLASHLOG_CUTS ? argv[1] : "erase");
+            return 0;
+        }
+    }
+    printf("usage: powercut [%s|sweep]\n", POWERCUT_POINTS);
+    return 1;
+}
+#endif
+
+#if CONFIG_DHT_STORAGE_ENABLE
+/*
+stress [seconds]: erase and program flash back to back while the sampler keeps reading, then report the reads'
+error rate over the run. Every failed checksum is at least one wrong bit; a timeout loses the rest of the transfer.
+*/
+static int console_stress_cmd(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 30;
+    if(seconds <= 0)
+        seconds = 30;
+    struct stats before;
+    sampler_get_stats(&before);
+
+    uint32_t erases = 0, writes = 0, failed = 0;
+    int64_t start = esp_timer_get_time(), busy_us = 0;
+    while(esp_timer_get_time() - start < seconds * 1000000LL)
+    {
+        int64_t t = esp_timer_get_time();
+        esp_err_t err = flashlog_stress_op(writes % 16 == 0, writes);
+        busy_us += esp_timer_get_time() - t;
+        if(err == ESP_ERR_INVALID_STATE)
+        {
+            printf("no free flash log sector to stress\n");
+            return 1;
+        }
+        failed += err != ESP_OK;
+        erases += writes % 16 == 0;
+        writes++;
+        //let lower priority tasks run now and then, the sampler preempts anyway
+        if(writes % 64 == 0)
+            vTaskDelay(1);
+    }
+    flashlog_stress_op(true, 0);
+
+    struct stats after;
+    sampler_get_stats(&after);
+    uint32_t reads = after.reads - before.reads;
+    uint32_t checksum = after.checksum_errors - before.checksum_errors, timeouts = after.timeouts - before.timeouts;
+    int64_t elapsed = esp_timer_get_time() - start;
+    printf("flash: %u erases, %u page writes, %u failed, busy %lld%% of %lld ms\n", erases, writes - erases, failed,
+           busy_us * 100 / elapsed, elapsed / 1000);
+    printf("sensor: %u reads, %u checksum errors, %u timeouts\n", reads, checksum, timeouts);
+    if(reads)
+        printf("bit error rate >= %u / %u bits (%.2e), frame error rate %.2e\n", checksum + timeouts, reads * 40,
+               (double)(checksum + timeouts) / (reads * 40), (double)(checksum + timeouts) / reads);
+    return 0;
+}
+#endif
+
+#if CONFIG_LOADGEN_ENABLE
+static void console_loadgen_row(int sensors, int hz, int seconds)
+{
+    struct loadgen_result r;
+    if(!loadgen_run(sensors, hz, seconds, &r))
+    {
+        printf("%7d out of memory\n", sensors);
+        return;
+    }
+    //no flash log, no flash stage
+    char flash_errors[12] = "-";
+    if(r.flash)
+        snprintf(flash_errors, sizeof(flash_errors), "%u", r.flash_errors);
+    printf("%7d %8lld %8u %8u %8u %6lld%% %8u %9s\n", sensors, r.samples * 1000000LL / r.elapsed_us, r.dropped,
+           r.samples ? (uint32_t)(r.busy_us / r.samples) : 0, r.max_ingest_us, r.busy_us * 100 / r.elapsed_us,
+           r.heap_bytes, flash_errors);
+}
+
+/*
+loadgen <sensors> [hz] [seconds]: one run of synthetic sensors through the pipeline.
+loadgen sweep [hz] [seconds]: 1, 2, 4 .. LOADGEN_MAX_SENSORS sensors, one row each.
+*/
+static int console_loadgen_cmd(int argc, char **argv)
+{
+    bool sweep = argc > 1 && strcmp(argv[1], "sweep") == 0;
+    int sensors = argc > 1 && !sweep ? atoi(argv[1]) : 0;
+    int hz = argc > 2 ? atoi(argv[2]) : 1;
+    int seconds = argc > 3 ? atoi(argv[3]) : 10;
+    if(argc < 2 || (!sweep && (sensors < 1 || sensors > CONFIG_LOADGEN_MAX_SENSORS)) || hz < 1 || hz > LOADGEN_MAX_HZ || seconds < 1)
+    {
+        printf("usage: loadgen <1-%d>|sweep [1-%d hz] [seconds]\n", CONFIG_LOADGEN_MAX_SENSORS, LOADGEN_MAX_HZ);
+        return 1;
+    }
+    printf("synthetic samples go to scratch copies and the flash bench area, not the live data or the flash log\n");
+    printf("sensors samples/s  dropped us/sample   max us    cpu     heap flash err\n");
+    if(!sweep)
+    {
+        console_loadgen_row(sensors, hz, seconds);
+        return 0;
+    }
+    for(sensors = 1; ; sensors = MIN(sensors * 2, CONFIG_LOADGEN_MAX_SENSORS))
+    {
+        console_loadgen_row(sensors, hz, seconds);
+        if(sensors == CONFIG_LOADGEN_MAX_SENSORS)
+            break;
+    }
+    return 0;
+}
+#endif
+
+void start_console(void)
+{
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "dht>";
+    repl_config.task_priority = CONFIG_CONSOLE_TASK_PRIORITY;
+    repl_config.task_stack_size = CONFIG_CONSOLE_STACK_SIZE;
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_console_new_repl_uart(&uart_config, &repl_config, &repl));
+
+    esp_console_register_help_command();
+    for(int i = 0; i < DEBUG_FORMATTER_COUNT; i++)
+    {
+        if(strcmp(s_debug_formatters[i].name, "config") == 0)
+            continue;
+        const esp_console_cmd_t cmd = {
+            .command = s_debug_formatters[i].name,
+            .help = s_debug_formatters[i].help,
+            .func = console_debug_cmd,
+        };
+        ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+    }
+    const esp_console_cmd_t config_cmd = {
+        .command = "config",
+        .help = "Show the runtime configuration, or change a field with 'config set <key> <value>'",
+        .hint = "[set <key> <value>]",
+        .func = console_config_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&config_cmd));
+    const esp_console_cmd_t bench_cmd = {
+        .command = "bench",
+        .help = "Time every debug formatter and the API router; 'bench http' compares httpd with the fast path",
+        .hint = "[iterations] | http [requests]",
+        .func = console_bench_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&bench_cmd));
+#if CONFIG_DHT_STORAGE_ENABLE
+    const esp_console_cmd_t stress_cmd = {
+        .command = "stress",
+        .help = "Erase and write flash continuously while sampling, then report the sensor bit error rate",
+        .hint = "[seconds]",
+        .func = console_stress_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&stress_cmd));
+#endif
+#if CONFIG_LOADGEN_ENABLE
+    const esp_console_cmd_t loadgen_cmd = {
+        .command = "loadgen",
+        .help = "Feed synthetic sensors through scratch copies of history, flash log, rollups and snapshots and report cost and drops",
+        .hint = "<sensors>|sweep [hz] [seconds]",
+        .func = console_loadgen_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&loadgen_cmd));
+#endif
+#if CONFIG_FLASHLOG_FAULT_INJECT
+    const esp_console_cmd_t powercut_cmd = {
+        .command = "powercut",
+        .help = "Restart right after the next flash log or rollup write of one kind and check the recovery at boot; 'sweep' tries each in turn",
+        .hint = "[" POWERCUT_POINTS "|sweep]",
+        .func = console_powercut_cmd,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&powercut_cmd));
+#endif
+    ESP_ERROR_CHECK(esp_console_start_repl(repl));
+}
+#endif
+/*Console section END*/
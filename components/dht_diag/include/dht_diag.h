@@ -0,0 +1,33 @@
+/*
+Instrumentation: sensor transaction trace, heap audit, the debug formatter table behind /api/v1/debug/ and the
+UART console. Without DHT_DIAG_ENABLE the hooks other components call compile away.
+*/
+#pragma once
+
+#include "dht_core.h"
+
+#if CONFIG_DHT_DIAG_ENABLE
+/*Diagnostics section*/
+void diag_record_read(const struct data *sample, uint32_t duration_us);
+#if CONFIG_HEAP_AUDIT
+void heap_audit_arm(void);
+#endif
+
+/*Debug formatter section*/
+struct debug_formatter{
+    const char *name;   //console command and /api/v1/debug/<name>
+    const char *help;
+    int (*format)(char *out, size_t len);
+};
+
+const struct debug_formatter *debug_find(const char *name);
+int debug_format_trace(char *out, size_t len);
+int debug_format_heap(char *out, size_t len);
+
+/*Console section*/
+#if CONFIG_CONSOLE_ENABLE
+void start_console(void);
+#endif
+#else
+#define diag_record_read(sample, duration_us)
+#endif
@@ -0,0 +1,541 @@
+#include <string.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "dht_sampler.h"
+#include "dht_exporters.h"
+#if CONFIG_FASTPATH_ENABLE
+#include "lwip/sockets.h"
+#endif
+#if CONFIG_PUSH_ENABLE
+#include "esp_http_client.h"
+#include "dht_wifi.h"
+#endif
+#if CONFIG_FASTPATH_ENABLE || CONFIG_PUSH_ENABLE
+
+static const char *TAG = "exporters";
+#endif
+
+/*Snapshot section START*/
+
+/*
+/metrics and /api/v1/current are rendered once per sample instead of once per request. Each document is kept as
+a complete HTTP/1.1 response, header block included, so the fast path can send it as is and httpd sends the body.
+The load generator renders into a set of its own that nothing serves.
+*/
+struct snapshot_doc{
+    uint16_t body_off;  //length of the header block
+    uint16_t len;       //header block and body
+    char text[SNAPSHOT_DOC_SIZE];
+};
+
+struct snapshot_set{
+    struct snapshot_doc docs[SNAPSHOT_DOCS];
+    int64_t sample_us;          //time of the reading the documents show, 0 before the first good one
+    struct data current;        //what SNAPSHOT_CURRENT shows, for projections of it
+    struct data good;           //last good sample
+    struct snapshot_doc doc;    //rendered here, then copied in under the lock
+    char body[SNAPSHOT_DOC_SIZE - 128];
+    SemaphoreHandle_t lock;     //NULL for a set nobody reads
+};
+
+static const char *const s_snapshot_types[SNAPSHOT_DOCS] = { "text/plain; version=0.0.4", "application/json" };
+static struct snapshot_set s_snapshot = { .good = { .status = DHT_ERR_NO_DATA } };
+static StaticSemaphore_t s_snapshot_lock_buf;
+
+const char *snapshot_type(enum snapshot_doc_id id)
+{
+    return s_snapshot_types[id];
+}
+
+static void snapshot_store(struct snapshot_set *set, enum snapshot_doc_id id, int len)
+{
+    struct snapshot_doc *doc = &set->doc;
+    len = MIN(len, SNAPSHOT_DOC_SIZE - 128);
+    doc->body_off = snprintf(doc->text, sizeof(doc->text), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n",
+                             s_snapshot_types[id], len);
+    memcpy(doc->text + doc->body_off, set->body, len);
+    doc->len = doc->body_off + len;
+    if(set->lock)
+        xSemaphoreTake(set->lock, portMAX_DELAY);
+    memcpy(&set->docs[id], doc, offsetof(struct snapshot_doc, text) + doc->len);
+    if(set->lock)
+        xSemaphoreGive(set->lock);
+}
+
+/*Render both documents into set; readings come from the last good sample so a failed read does not blank them*/
+void snapshot_render(struct snapshot_set *set, const struct data *sample, const struct stats *st)
+{
+    if(sample->status == DHT_OK)
+        set->good = *sample;
+    const struct data good = set->good;
+    char *body = set->body;
+    long long t = good.status == DHT_OK ? clock_wall_us(good.mono_us) / 1000 : 0;
+    int n = 0;
+
+    if(good.status == DHT_OK)
+        APPEND(body, sizeof(set->body), n, "# TYPE dht_temperature_celsius gauge\ndht_temperature_celsius " TENTHS_FMT "\n"
+               "# TYPE dht_humidity_percent gauge\ndht_humidity_percent " TENTHS_FMT "\n"
+               "# TYPE dht_sample_timestamp_seconds gauge\ndht_sample_timestamp_seconds %lld.%03lld\n",
+               TENTHS_ARGS(good.temperature), TENTHS_ARGS(good.humidity), t / 1000, t % 1000);
+    APPEND(body, sizeof(set->body), n, "# TYPE dht_status gauge\ndht_status %u\n"
+           "# TYPE dht_reads_total counter\ndht_reads_total %u\n"
+           "# TYPE dht_checksum_errors_total counter\ndht_checksum_errors_total %u\n"
+           "# TYPE dht_timeouts_total counter\ndht_timeouts_total %u\n"
+           "# TYPE dht_flash_errors_total counter\ndht_flash_errors_total %u\n"
+           "# TYPE dht_read_max_microseconds gauge\ndht_read_max_microseconds %u\n",
+           sample->status, st->reads, st->checksum_errors, st->timeouts, st->flash_errors, st->max_read_us);
+    snapshot_store(set, SNAPSHOT_METRICS, n);
+
+    //status of this read, readings of the last good one; no good one yet renders them as null
+    struct data current = good.status == DHT_OK ? good : (struct data){ .sensor = sample->sensor };
+    current.status = sample->status;
+    n = fields_format_json(body, sizeof(set->body), sample_fields, SNAPSHOT_CURRENT_FIELDS, &current);
+    snapshot_store(set, SNAPSHOT_CURRENT, n);
+
+    if(set->lock)
+        xSemaphoreTake(set->lock, portMAX_DELAY);
+    set->sample_us = good.status == DHT_OK ? good.mono_us : 0;
+    set->current = current;
+    if(set->lock)
+        xSemaphoreGive(set->lock);
+}
+
+/*Called by the sampler after every read, only the sampler renders the served set*/
+void snapshot_publish(const struct data *sample, const struct stats *st)
+{
+    snapshot_render(&s_snapshot, sample, st);
+}
+
+/*A set for the load generator to render into, released with free()*/
+struct snapshot_set *snapshot_set_alloc(void)
+{
+    struct snapshot_set *set = calloc(1, sizeof(*set));
+    if(set)
+        set->good.status = DHT_ERR_NO_DATA;
+    return set;
+}
+
+/*
+Copy a document into out, with its header block for the fast path or just the body for httpd; returns its length.
+Every copy is a scrape being served, so it is counted for the sampling schedule here.
+*/
+int snapshot_copy(enum snapshot_doc_id id, bool with_header, char *out, size_t len)
+{
+    xSemaphoreTake(s_snapshot.lock, portMAX_DELAY);
+    const struct snapshot_doc *doc = &s_snapshot.docs[id];
+    uint16_t off = with_header ? 0 : doc->body_off;
+    int n = MIN(doc->len - off, len);
+    memcpy(out, doc->text + off, n);
+    int64_t sample_us = s_snapshot.sample_us;
+    xSemaphoreGive(s_snapshot.lock);
+    schedule_note_scrape(sample_us);
+    return n;
+}
+
+/*/api/v1/current?fields=: the same reading rendered with only the sample_fields in mask*/
+int snapshot_format_current(uint32_t mask, char *out, size_t len)
+{
+    xSemaphoreTake(s_snapshot.lock, portMAX_DELAY);
+    struct data current = s_snapshot.current;
+    int64_t sample_us = s_snapshot.sample_us;
+    xSemaphoreGive(s_snapshot.lock);
+    schedule_note_scrape(sample_us);
+    return fields_format_json(out, len, sample_fields, mask, &current);
+}
+
+void snapshot_init(void)
+{
+    s_snapshot.lock = xSemaphoreCreateMutexStatic(&s_snapshot_lock_buf);
+    struct data none = { .status = DHT_ERR_NO_DATA };
+    struct stats st = { 0 };
+    snapshot_publish(&none, &st);
+}
+/*Snapshot section END*/
+
+
+/*Fast path section START*/
+#if CONFIG_FASTPATH_ENABLE
+/*
+Minimal HTTP/1.1 responder on FASTPATH_PORT for scrapers, straight on lwIP sockets. It answers GET /metrics and
+GET /api/v1/current with the pre-rendered snapshot, header block included, so a request costs a recv, a prefix
+compare, a copy and a send; anything else gets a fixed 404. Connections are kept alive unless the client asks
+otherwise, one task serves up to FASTPATH_MAX_CLIENTS of them through select().
+*/
+#define FASTPATH_REQ_SIZE 512
+
+struct fastpath_client{
+    int fd;
+    uint16_t len;
+    char req[FASTPATH_REQ_SIZE];   //NUL terminated
+};
+
+struct fastpath_stats{
+    uint32_t requests;
+    uint32_t not_found;
+    uint32_t refused;     //accepted while all client slots were in use
+    uint32_t max_us;
+    uint64_t busy_us;     //from a complete request to the response handed to lwIP
+};
+
+static struct fastpath_client s_fastpath_clients[CONFIG_FASTPATH_MAX_CLIENTS];
+static char s_fastpath_resp[SNAPSHOT_DOC_SIZE];
+static struct fastpath_stats s_fastpath_stats;
+static portMUX_TYPE s_fastpath_mux = portMUX_INITIALIZER_UNLOCKED;
+static StackType_t s_fastpath_stack[CONFIG_FASTPATH_STACK_SIZE];
+static StaticTask_t s_fastpath_tcb;
+static TaskHandle_t s_fastpath_task;
+
+static const char s_fastpath_404[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+
+static bool fastpath_send(int fd, const char *buf, size_t len)
+{
+    while(len)
+    {
+        int n = send(fd, buf, len, 0);
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*Answer every complete request in the buffer, pipelined ones included; false closes the connection*/
+static bool fastpath_serve(struct fastpath_client *c)
+{
+    for(;;)
+    {
+        char *end = strstr(c->req, "\r\n\r\n");
+        if(end == NULL)
+            return c->len < FASTPATH_REQ_SIZE - 1;  //a header that fills the buffer is not one we serve
+        int64_t start = esp_timer_get_time();
+        uint16_t req_len = end + 4 - c->req;
+        end[2] = 0;
+        bool close = strstr(c->req, "Connection: close") || strstr(c->req, "connection: close") || strstr(c->req, " HTTP/1.0\r\n");
+
+        const char *resp = s_fastpath_404;
+        int n = sizeof(s_fastpath_404) - 1;
+        if(strncmp(c->req, "GET /metrics ", 13) == 0)
+            resp = s_fastpath_resp, n = snapshot_copy(SNAPSHOT_METRICS, true, s_fastpath_resp, sizeof(s_fastpath_resp));
+        else if(strncmp(c->req, "GET /api/v1/current ", 20) == 0)
+            resp = s_fastpath_resp, n = snapshot_copy(SNAPSHOT_CURRENT, true, s_fastpath_resp, sizeof(s_fastpath_resp));
+        if(!fastpath_send(c->fd, resp, n))
+            return false;
+
+        uint32_t us = esp_timer_get_time() - start;
+        portENTER_CRITICAL(&s_fastpath_mux);
+        s_fastpath_stats.requests++;
+        s_fastpath_stats.not_found += resp == s_fastpath_404;
+        s_fastpath_stats.busy_us += us;
+        s_fastpath_stats.max_us = MAX(s_fastpath_stats.max_us, us);
+        portEXIT_CRITICAL(&s_fastpath_mux);
+
+        c->len -= req_len;
+        memmove(c->req, c->req + req_len, c->len + 1);
+        if(close)
+            return false;
+    }
+}
+
+static void fastpath_task(void *arg)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(CONFIG_FASTPATH_PORT), .sin_addr.s_addr = htonl(INADDR_ANY) };
+    int one = 1;
+    int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 2) != 0)
+    {
+        ESP_LOGE(TAG, "fast path cannot listen on port %d", CONFIG_FASTPATH_PORT);
+        vTaskDelete(NULL);
+    }
+    for(int i = 0; i < CONFIG_FASTPATH_MAX_CLIENTS; i++)
+        s_fastpath_clients[i].fd = -1;
+
+    for(;;)
+    {
+        fd_set rd;
+        FD_ZERO(&rd);
+        FD_SET(listener, &rd);
+        int max_fd = listener;
+        for(int i = 0; i < CONFIG_FASTPATH_MAX_CLIENTS; i++)
+        {
+            if(s_fastpath_clients[i].fd >= 0)
+            {
+                FD_SET(s_fastpath_clients[i].fd, &rd);
+                max_fd = MAX(max_fd, s_fastpath_clients[i].fd);
+            }
+        }
+        if(select(max_fd + 1, &rd, NULL, NULL, NULL) <= 0)
+            continue;
+
+        if(FD_ISSET(listener, &rd))
+        {
+            int fd = accept(listener, NULL, NULL);
+            struct fastpath_client *c = NULL;
+            for(int i = 0; i < CONFIG_FASTPATH_MAX_CLIENTS && c == NULL; i++)
+                if(s_fastpath_clients[i].fd < 0)
+                    c = &s_fastpath_clients[i];
+            if(fd >= 0 && c == NULL)
+            {
+                close(fd);
+                portENTER_CRITICAL(&s_fastpath_mux);
+                s_fastpath_stats.refused++;
+                portEXIT_CRITICAL(&s_fastpath_mux);
+            }
+            else if(fd >= 0)
+            {
+                //responses are one small write, send them now; a stalled client must not hold up the others for long
+                struct timeval timeout = { .tv_sec = 1 };
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                c->fd = fd;
+                c->len = 0;
+                c->req[0] = 0;
+            }
+        }
+
+        for(int i = 0; i < CONFIG_FASTPATH_MAX_CLIENTS; i++)
+        {
+            struct fastpath_client *c = &s_fastpath_clients[i];
+            if(c->fd < 0 || !FD_ISSET(c->fd, &rd))
+                continue;
+            int n = recv(c->fd, c->req + c->len, FASTPATH_REQ_SIZE - 1 - c->len, 0);
+            if(n > 0)
+            {
+                c->len += n;
+                c->req[c->len] = 0;
+            }
+            if(n <= 0 || !fastpath_serve(c))
+            {
+                close(c->fd);
+                c->fd = -1;
+            }
+        }
+    }
+}
+
+TaskHandle_t fastpath_task_handle(void)
+{
+    return s_fastpath_task;
+}
+
+void start_fastpath(void)
+{
+    s_fastpath_task = xTaskCreateStatic(fastpath_task, "fastpath", CONFIG_FASTPATH_STACK_SIZE, NULL, 5, s_fastpath_stack, &s_fastpath_tcb);
+}
+
+int debug_format_fastpath(char *out, size_t len)
+{
+    portENTER_CRITICAL(&s_fastpath_mux);
+    struct fastpath_stats st = s_fastpath_stats;
+    portEXIT_CRITICAL(&s_fastpath_mux);
+    int clients = 0;
+    for(int i = 0; i < CONFIG_FASTPATH_MAX_CLIENTS; i++)
+        clients += s_fastpath_clients[i].fd >= 0;
+    int n = 0;
+    APPEND(out, len, n, "{\"port\":%d,\"clients\":%d,\"requests\":%u,\"not_found\":%u,\"refused\":%u,\"avg_us\":%u,\"max_us\":%u}",
+           CONFIG_FASTPATH_PORT, clients, st.requests, st.not_found, st.refused,
+           st.requests ? (uint32_t)(st.busy_us / st.requests) : 0, st.max_us);
+    return n;
+}
+#endif
+/*Fast path section END*/
+
+
+/*Push section START*/
+#if CONFIG_PUSH_ENABLE
+/*
+HTTP push to PUSH_URL for collectors that cannot scrape: held samples are POSTed as
+{"samples":[{"id":..,"t":..,"temperature":..,"humidity":..},...]} from a cursor into the history ring, which only
+moves on a 2xx, so a failed upload is retried with the samples still held. Retries back off, from the current
+interval doubling up to PUSH_MAX_INTERVAL_MS, and new samples do not cut the wait short.
+How much to wait for is decided per upload from the link. Each of RSSI, the recent upload failure rate (Wi-Fi drops
+count as failures) and the upload latency maps to a weakness of 0-100, and the worst one sets the batch size and the
+longest a sample may wait, between 1 sample at PUSH_MIN_INTERVAL_MS on a good link and PUSH_MAX_BATCH at
+PUSH_MAX_INTERVAL_MS on a bad one. A strong link thus sends every sample as it arrives, a weak one sends few large
+uploads, which cost less airtime per sample and give a retry more to show for it.
+*/
+#define PUSH_MAX_BATCH      CONFIG_PUSH_MAX_BATCH
+#define PUSH_ROW_MAX        80        //one sample with PUSH_FIELDS
+#define PUSH_BODY_SIZE      (PUSH_MAX_BATCH * PUSH_ROW_MAX + 32)
+#define PUSH_FIELDS         (FIELDS_MASK(SAMPLE_FIELDS) & ~(1u << SAMPLE_FIELD_STATUS))
+#define PUSH_RSSI_GOOD      -60       //dBm, weakness 0 at or above
+#define PUSH_RSSI_BAD       -80       //weakness 100 at or below
+#define PUSH_LATENCY_GOOD   100       //ms
+#define PUSH_LATENCY_BAD    1000
+
+struct push_stats{
+    uint32_t uploads;
+    uint32_t failures;
+    uint32_t samples;
+    uint64_t bytes;
+    uint32_t latency_ms;  //moving average of successful uploads
+    uint32_t fail_pct;    //moving average, uploads and Wi-Fi drops
+    uint32_t weakness;    //of the last decision
+    uint32_t batch;
+    uint32_t interval_ms;
+    uint32_t backoff_ms;  //wait after the last failure, 0 after a success
+    int8_t rssi;
+};
+
+static struct push_stats s_push_stats;
+static portMUX_TYPE s_push_mux = portMUX_INITIALIZER_UNLOCKED;
+static StackType_t s_push_stack[4096];
+static StaticTask_t s_push_tcb;
+static char s_push_body[PUSH_BODY_SIZE];
+static struct data s_push_batch[PUSH_MAX_BATCH];
+
+static uint32_t push_scale(int32_t v, int32_t good, int32_t bad)
+{
+    int32_t w = (v - good) * 100 / (bad - good);
+    return MIN(MAX(w, 0), 100);
+}
+
+/*Upload count samples from s_push_batch; returns whether the collector took them*/
+static bool push_upload(esp_http_client_handle_t client, uint32_t count)
+{
+    int n = 0;
+    APPEND(s_push_body, sizeof(s_push_body), n, "{\"samples\":[");
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(i)
+            APPEND(s_push_body, sizeof(s_push_body), n, ",");
+        n += fields_format_json(s_push_body + MIN((size_t)n, sizeof(s_push_body)), sizeof(s_push_body) - MIN((size_t)n, sizeof(s_push_body)),
+                                sample_fields, PUSH_FIELDS, &s_push_batch[i]);
+    }
+    APPEND(s_push_body, sizeof(s_push_body), n, "]}");
+    if(n >= sizeof(s_push_body))
+        return false;
+
+    int64_t start = esp_timer_get_time();
+    esp_http_client_set_post_field(client, s_push_body, n);
+    esp_err_t err = esp_http_client_perform(client);
+    int status = esp_http_client_get_status_code(client);
+    bool ok = err == ESP_OK && status / 100 == 2;
+    uint32_t ms = (esp_timer_get_time() - start) / 1000;
+
+    portENTER_CRITICAL(&s_push_mux);
+    s_push_stats.uploads++;
+    s_push_stats.fail_pct = (s_push_stats.fail_pct * 3 + (ok ? 0 : 100)) / 4;
+    if(ok)
+    {
+        s_push_stats.samples += count;
+        s_push_stats.bytes += n;
+        //the first success seeds the average, failures before it do not count as 0 ms
+        bool first = s_push_stats.uploads - s_push_stats.failures == 1;
+        s_push_stats.latency_ms = first ? ms : (s_push_stats.latency_ms * 3 + ms) / 4;
+    }
+    else
+        s_push_stats.failures++;
+    portEXIT_CRITICAL(&s_push_mux);
+    if(!ok)
+        ESP_LOGW(TAG, "push of %u samples failed: %s, status %d", count, esp_err_to_name(err), status);
+    return ok;
+}
+
+static void push_task(void *arg)
+{
+    esp_http_client_config_t cfg = {
+        .url = CONFIG_PUSH_URL,
+        .method = HTTP_METHOD_POST,
+        .timeout_ms = CONFIG_PUSH_TIMEOUT_MS,
+        .keep_alive_enable = true,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&cfg);
+    esp_http_client_set_header(client, "Content-Type", "application/json");
+
+    sampler_lock();
+    uint32_t cursor = history_seq();
+    sampler_unlock();
+    struct wifi_link link;
+    wifi_link_get(&link);
+    uint32_t disconnects = link.disconnects;
+    int64_t retry_us = 0;   //no upload before this, set by a failure
+    uint32_t backoff_ms = 0;
+    for(;;)
+    {
+        //the link decides how many samples are worth an upload and how long the oldest may wait for them
+        wifi_link_get(&link);
+        portENTER_CRITICAL(&s_push_mux);
+        if(link.disconnects != disconnects)
+            s_push_stats.fail_pct = (s_push_stats.fail_pct * 3 + 100) / 4;
+        uint32_t weakness = MAX(push_scale(link.rssi, PUSH_RSSI_GOOD, PUSH_RSSI_BAD), s_push_stats.fail_pct);
+        weakness = MAX(weakness, push_scale(s_push_stats.latency_ms, PUSH_LATENCY_GOOD, PUSH_LATENCY_BAD));
+        uint32_t batch = 1 + (PUSH_MAX_BATCH - 1) * weakness / 100;
+        uint32_t interval_ms = CONFIG_PUSH_MIN_INTERVAL_MS + (CONFIG_PUSH_MAX_INTERVAL_MS - CONFIG_PUSH_MIN_INTERVAL_MS) * weakness / 100;
+        s_push_stats.weakness = weakness;
+        s_push_stats.batch = batch;
+        s_push_stats.interval_ms = interval_ms;
+        s_push_stats.rssi = link.rssi;
+        portEXIT_CRITICAL(&s_push_mux);
+        disconnects = link.disconnects;
+
+        //oldest pending sample, the cursor skips ahead if the ring has dropped it
+        sampler_lock();
+        uint32_t seq = cursor;
+        uint32_t count = history_copy(&seq, s_push_batch, PUSH_MAX_BATCH);
+        uint32_t pending = history_seq() - (seq - count);
+        sampler_unlock();
+        cursor = seq - count;
+
+        //after a failure nothing goes out for the backoff, however many samples wake the task meanwhile
+        int64_t now = esp_timer_get_time();
+        TickType_t wait = pdMS_TO_TICKS(interval_ms);
+        if(now < retry_us)
+            wait = pdMS_TO_TICKS((retry_us - now + 999) / 1000);
+        else if(count)
+        {
+            uint32_t age_ms = (now - s_push_batch[0].mono_us) / 1000;
+            if(link.connected && (pending >= batch || age_ms >= interval_ms))
+            {
+                if(push_upload(client, count))
+                {
+                    cursor += count;
+                    backoff_ms = 0;
+                    if(pending > count)
+                        continue;   //more than one batch was held
+                }
+                else
+                {
+                    //doubles from the current interval up to PUSH_MAX_INTERVAL_MS, reconnect on the next try
+                    esp_http_client_close(client);
+                    backoff_ms = backoff_ms ? MIN(backoff_ms * 2, CONFIG_PUSH_MAX_INTERVAL_MS) : interval_ms;
+                    retry_us = esp_timer_get_time() + backoff_ms * 1000LL;
+                    wait = pdMS_TO_TICKS(backoff_ms);
+                }
+                portENTER_CRITICAL(&s_push_mux);
+                s_push_stats.backoff_ms = backoff_ms;
+                portEXIT_CRITICAL(&s_push_mux);
+            }
+            else if(age_ms < interval_ms)
+                wait = pdMS_TO_TICKS(interval_ms - age_ms);
+        }
+        ulTaskNotifyTake(pdTRUE, MAX(wait, 1));
+    }
+}
+
+void start_push(void)
+{
+    TaskHandle_t task = xTaskCreateStatic(push_task, "push", sizeof(s_push_stack), NULL, 4, s_push_stack, &s_push_tcb);
+    sampler_add_listener(task);
+}
+
+int debug_format_push(char *out, size_t len)
+{
+    portENTER_CRITICAL(&s_push_mux);
+    struct push_stats st = s_push_stats;
+    portEXIT_CRITICAL(&s_push_mux);
+    int n = 0;
+    APPEND(out, len, n, "{\"rssi\":%d,\"fail_pct\":%u,\"latency_ms\":%u,\"weakness\":%u,\"batch\":%u,\"interval_ms\":%u,\"backoff_ms\":%u,"
+           "\"uploads\":%u,\"failures\":%u,\"samples\":%u,\"samples_per_upload_x10\":%u,\"bytes_per_sample\":%u}",
+           st.rssi, st.fail_pct, st.latency_ms, st.weakness, st.batch, st.interval_ms, st.backoff_ms, st.uploads, st.failures, st.samples,
+           st.uploads - st.failures ? st.samples * 10 / (st.uploads - st.failures) : 0,
+           st.samples ? (uint32_t)(st.bytes / st.samples) : 0);
+    return n;
+}
+#endif
+/*Push section END*/
@@ -0,0 +1,41 @@
+/*
+Exporters: the pre-rendered /metrics and /api/v1/current documents, with FASTPATH_ENABLE the raw socket responder
+that serves them without httpd and with PUSH_ENABLE the HTTP push to a collector.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "dht_core.h"
+
+struct stats;
+
+/*Snapshot section*/
+#define SNAPSHOT_DOC_SIZE 1024
+
+enum snapshot_doc_id { SNAPSHOT_METRICS, SNAPSHOT_CURRENT, SNAPSHOT_DOCS };
+
+/*sample_fields shown by /api/v1/current when no ?fields= is given*/
+#define SNAPSHOT_CURRENT_FIELDS (FIELDS_MASK(SAMPLE_FIELDS) & ~(1u << SAMPLE_FIELD_ID))
+
+void snapshot_init(void);
+void snapshot_publish(const struct data *sample, const struct stats *st);
+struct snapshot_set;
+struct snapshot_set *snapshot_set_alloc(void);
+void snapshot_render(struct snapshot_set *set, const struct data *sample, const struct stats *st);
+int snapshot_copy(enum snapshot_doc_id id, bool with_header, char *out, size_t len);
+const char *snapshot_type(enum snapshot_doc_id id);
+int snapshot_format_current(uint32_t mask, char *out, size_t len);
+
+/*Fast path section*/
+#if CONFIG_FASTPATH_ENABLE
+void start_fastpath(void);
+TaskHandle_t fastpath_task_handle(void);
+int debug_format_fastpath(char *out, size_t len);
+#endif
+
+/*Push section*/
+#if CONFIG_PUSH_ENABLE
+void start_push(void);
+int debug_format_push(char *out, size_t len);
+#endif
@@ -0,0 +1,767 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "dht_sensor.h"
+#include "dht_sampler.h"
+#if CONFIG_DHT_STORAGE_ENABLE
+#include "dht_storage.h"
+#endif
+#if CONFIG_DHT_EXPORTERS_ENABLE
+#include "dht_exporters.h"
+#endif
+#include "dht_diag.h"
+
+static const char *TAG = "sampler";
+
+static SemaphoreHandle_t s_data_lock;
+static StaticSemaphore_t s_data_lock_buf;
+
+/*Heatmap section START*/
+
+/*
+Time spent per temperature band per day. Rows form a ring indexed by day number so an update is a single
+add into a fixed array; a row is cleared the first time a new day lands on it. A sample is credited with the time
+since the previous good one, failed reads and stretched waits included, up to HEATMAP_MAX_GAP intervals so an
+outage is not put down to whatever was read before it. Samples stamped before HEATMAP_MIN_DAY come from a clock
+that was never set and are left out rather than filed under 1970.
+*/
+#define HEATMAP_MAX_GAP 4
+#define HEATMAP_MIN_DAY 18262   //2020-01-01
+
+struct heatmap_state{
+    struct heatmap map;
+    int64_t last_ms;    //monotonic time of the last sample added, -1 before the first
+};
+
+static struct heatmap_state s_heatmap = { .last_ms = -1 };
+#if CONFIG_DHT_STORAGE_ENABLE
+_Static_assert(sizeof(struct heatmap) <= FLASHLOG_CKPT_MAX,
+               "heatmap does not fit a checkpoint: HEATMAP_DAYS * (HEATMAP_BANDS + 1) must be at most 1020");
+#endif
+
+/*Mark every row empty, and any row a checkpoint holds for a day before HEATMAP_MIN_DAY*/
+static void heatmap_clear_invalid(struct heatmap *map, bool all)
+{
+    for(int i = 0; i < HEATMAP_DAYS; i++)
+        if(all || map->day[i] < HEATMAP_MIN_DAY)
+        {
+            map->day[i] = HEATMAP_DAY_NONE;
+            memset(map->ms[i], 0, sizeof(map->ms[i]));
+        }
+}
+
+static int heatmap_band(int16_t temperature)
+{
+    int band = (temperature - CONFIG_HEATMAP_BAND_MIN_C * 10) / (CONFIG_HEATMAP_BAND_WIDTH_C * 10);
+    if(temperature < CONFIG_HEATMAP_BAND_MIN_C * 10)
+        band = 0;
+    return band >= HEATMAP_BANDS ? HEATMAP_BANDS - 1 : band;
+}
+
+/*interval_ms is the sampling interval, credited to the first sample and the base of the gap cap*/
+static void heatmap_add(struct heatmap_state *h, const struct data *sample, uint32_t interval_ms)
+{
+    int64_t now_ms = sample->mono_us / 1000;
+    uint32_t ms = h->last_ms < 0 ? interval_ms : MIN(MAX(now_ms - h->last_ms, 0), (int64_t)interval_ms * HEATMAP_MAX_GAP);
+    h->last_ms = now_ms;
+    int64_t day = clock_wall_us(sample->mono_us) / 1000000 / 86400;
+    if(day < HEATMAP_MIN_DAY)
+        return;
+    uint32_t row = day % HEATMAP_DAYS;
+    if(h->map.day[row] != day)
+    {
+        h->map.day[row] = day;
+        memset(h->map.ms[row], 0, sizeof(h->map.ms[row]));
+    }
+    h->map.ms[row][heatmap_band(sample->temperature)] += ms;
+}
+
+void heatmap_get(struct heatmap *out)
+{
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    *out = s_heatmap.map;
+    xSemaphoreGive(s_data_lock);
+}
+
+/*Newest day held, HEATMAP_DAY_NONE while the heatmap is empty*/
+uint32_t heatmap_newest_day(void)
+{
+    uint32_t newest = HEATMAP_DAY_NONE;
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    for(int i = 0; i < HEATMAP_DAYS; i++)
+        if(s_heatmap.map.day[i] != HEATMAP_DAY_NONE && (newest == HEATMAP_DAY_NONE || s_heatmap.map.day[i] > newest))
+            newest = s_heatmap.map.day[i];
+    xSemaphoreGive(s_data_lock);
+    return newest;
+}
+
+/*Copy one day's HEATMAP_BANDS cells into ms; false if the day is not held*/
+bool heatmap_get_day(uint32_t day, uint32_t *ms)
+{
+    uint32_t row = day % HEATMAP_DAYS;
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    bool held = day != HEATMAP_DAY_NONE && s_heatmap.map.day[row] == day;
+    if(held)
+        memcpy(ms, s_heatmap.map.ms[row], sizeof(s_heatmap.map.ms[row]));
+    xSemaphoreGive(s_data_lock);
+    return held;
+}
+/*Heatmap section END*/
+
+
+/*History section START*/
+
+/*
+Recent good samples in RAM, oldest overwritten first. Entries keep only the low 32 bits of the monotonic time
+in ms; the full time is rebuilt as a delta from the newest sample, which is exact while the ring spans < 49 days.
+The ring storage is sized by Kconfig, the runtime depth only limits how much of it is used.
+*/
+struct history_entry{
+    uint32_t mono_ms;
+    int16_t temperature;
+    uint16_t humidity;
+    uint16_t sensor;
+} __attribute__((packed));
+
+struct history_ring{
+    struct history_entry *slots;
+    uint32_t depth;
+    uint32_t head;      //slot the next sample goes into
+    uint32_t count;
+    uint32_t seq;       //samples ever pushed, the oldest held is seq - count
+    int64_t newest_ms;
+};
+
+static struct history_entry s_history_slots[CONFIG_HISTORY_MAX_DEPTH];
+static struct history_ring s_history = { .slots = s_history_slots, .depth = CONFIG_HISTORY_MAX_DEPTH };
+
+static void history_reverse(struct history_entry *e, uint32_t n)
+{
+    for(uint32_t i = 0; i < n / 2; i++)
+    {
+        struct history_entry t = e[i];
+        e[i] = e[n - 1 - i];
+        e[n - 1 - i] = t;
+    }
+}
+
+/*Shrinking keeps the newest samples; depth must fit the ring's slots. Called with s_data_lock held for s_history*/
+static void history_set_depth(struct history_ring *h, uint32_t depth)
+{
+    if(depth == h->depth)
+        return;
+    //rotate the oldest sample to slot 0 in place, three reversals, then drop the oldest that no longer fit
+    uint32_t first = (h->head + h->depth - h->count) % h->depth;
+    history_reverse(h->slots, first);
+    history_reverse(h->slots + first, h->depth - first);
+    history_reverse(h->slots, h->depth);
+    uint32_t keep = MIN(h->count, depth);
+    memmove(h->slots, h->slots + h->count - keep, keep * sizeof(h->slots[0]));
+    h->depth = depth;
+    h->count = keep;
+    h->head = keep % depth;
+}
+
+static void history_push(struct history_ring *h, const struct data *sample)
+{
+    int64_t ms = sample->mono_us / 1000;
+    h->slots[h->head] = (struct history_entry){ .mono_ms = ms, .temperature = sample->temperature, .humidity = sample->humidity,
+                                                .sensor = sample->sensor };
+    h->head = (h->head + 1) % h->depth;
+    h->count = MIN(h->count + 1, h->depth);
+    h->seq++;
+    h->newest_ms = ms;
+}
+
+uint32_t history_count(void)
+{
+    return s_history.count;
+}
+
+uint32_t history_depth(void)
+{
+    return s_history.depth;
+}
+
+/*Sequence number the next sample gets*/
+uint32_t history_seq(void)
+{
+    return s_history.seq;
+}
+
+/*i = 0 is the oldest sample still held*/
+void history_get(uint32_t i, struct data *out)
+{
+    const struct history_ring *h = &s_history;
+    const struct history_entry *e = &h->slots[(h->head + h->depth - h->count + i) % h->depth];
+    out->mono_us = (h->newest_ms - (uint32_t)((uint32_t)h->newest_ms - e->mono_ms)) * 1000;
+    out->temperature = e->temperature;
+    out->humidity = e->humidity;
+    out->status = DHT_OK;
+    out->sensor = e->sensor;
+}
+
+/*
+Copy up to n samples starting at sequence number *seq and advance it. Samples already overwritten are skipped,
+so a reader holding a sequence number across lock releases never sees one twice. Called with s_data_lock held.
+*/
+uint32_t history_copy(uint32_t *seq, struct data *out, uint32_t n)
+{
+    uint32_t first = s_history.seq - s_history.count;
+    if((int32_t)(*seq - first) < 0)
+        *seq = first;
+    n = MIN(n, s_history.seq - *seq);
+    for(uint32_t i = 0; i < n; i++)
+        history_get(*seq - first + i, &out[i]);
+    *seq += n;
+    return n;
+}
+/*History section END*/
+
+
+/*Schedule section START*/
+
+/*
+Collectors scrape at a fixed interval and phase. The phase of every scrape within the sample interval goes into a
+histogram whose older entries decay; once one phase clearly dominates, the sampler stretches a wait so that a fresh
+sample is published SAMPLE_PHASE_LEAD_MS before the expected scrape. The age of the data handed out at every
+scrape is kept in tenths of the interval, the last bucket being a whole interval or more.
+*/
+#define SCHEDULE_PHASE_BINS  20
+#define SCHEDULE_DECAY_AT    1024   //total weight at which every bin is halved, one scrape weighs 16
+#define SCHEDULE_MIN_SHARE   30     //percent of the weight the peak bin and its neighbours must hold
+#define SCHEDULE_MIN_SCRAPES 8
+#define SCHEDULE_AGE_BUCKETS 11
+#if CONFIG_SAMPLE_PHASE_ALIGN
+#define SCHEDULE_ALIGN true
+#else
+#define SCHEDULE_ALIGN false        //learn and report only
+#endif
+
+struct schedule_stats{
+    uint32_t interval_ms;   //the phase bins are for this interval, a new one starts over
+    uint32_t phase[SCHEDULE_PHASE_BINS];
+    uint32_t weight;
+    uint32_t scrapes;
+    int32_t scrape_ms;      //dominant scrape phase, -1 while none
+    int32_t target_ms;      //wake-up phase the sampler aims for, -1 while none
+    uint32_t shifts;
+    uint32_t age[SCHEDULE_AGE_BUCKETS];
+    uint32_t age_count;
+    uint64_t age_total_ms;
+};
+
+static struct schedule_stats s_schedule = { .scrape_ms = -1, .target_ms = -1 };
+static portMUX_TYPE s_schedule_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*Phases are taken on the tick clock, the one vTaskDelayUntil runs on*/
+static uint32_t schedule_phase(TickType_t ticks, uint32_t interval)
+{
+    return (uint64_t)ticks * portTICK_PERIOD_MS % interval;
+}
+
+/*Called for every /metrics and /api/v1/current served, sample_us is the reading's time (0 if there is none)*/
+void schedule_note_scrape(int64_t sample_us)
+{
+    TickType_t now = xTaskGetTickCount();
+    int64_t age_ms = (esp_timer_get_time() - sample_us) / 1000;
+    portENTER_CRITICAL(&s_schedule_mux);
+    uint32_t interval = s_schedule.interval_ms;
+    if(interval)
+    {
+        s_schedule.phase[schedule_phase(now, interval) * SCHEDULE_PHASE_BINS / interval] += 16;
+        s_schedule.weight += 16;
+        s_schedule.scrapes++;
+        if(s_schedule.weight >= SCHEDULE_DECAY_AT)
+        {
+            s_schedule.weight = 0;
+            for(int i = 0; i < SCHEDULE_PHASE_BINS; i++)
+                s_schedule.weight += s_schedule.phase[i] /= 2;
+        }
+        if(sample_us)
+        {
+            s_schedule.age[MIN(age_ms * 10 / interval, SCHEDULE_AGE_BUCKETS - 1)]++;
+            s_schedule.age_count++;
+            s_schedule.age_total_ms += age_ms;
+        }
+    }
+    portEXIT_CRITICAL(&s_schedule_mux);
+}
+
+/*
+Ticks the sampler waits before its next read. Normally one interval; when the scrape phase is known and the next
+wake-up would land more than a bin away from the target the wait is stretched, never shortened since the sensor
+needs its rest between reads. publish_ms is how long after waking up the last sample was published.
+*/
+TickType_t schedule_next_wait(TickType_t last_wake, uint32_t interval, uint32_t publish_ms)
+{
+    uint32_t bin_ms = interval / SCHEDULE_PHASE_BINS;
+    portENTER_CRITICAL(&s_schedule_mux);
+    if(s_schedule.interval_ms != interval)
+    {
+        memset(s_schedule.phase, 0, sizeof(s_schedule.phase));
+        s_schedule.weight = s_schedule.scrapes = 0;
+        s_schedule.interval_ms = interval;
+    }
+    //a phase on a bin edge is split between two bins, so compare each bin together with its neighbours
+    int best = 0;
+    uint32_t best_w = 0;
+    for(int i = 0; i < SCHEDULE_PHASE_BINS; i++)
+    {
+        uint32_t w = s_schedule.phase[(i + SCHEDULE_PHASE_BINS - 1) % SCHEDULE_PHASE_BINS] + s_schedule.phase[i] +
+                     s_schedule.phase[(i + 1) % SCHEDULE_PHASE_BINS];
+        if(w > best_w)
+        {
+            best = i;
+            best_w = w;
+        }
+    }
+    s_schedule.scrape_ms = s_schedule.target_ms = -1;
+    if(s_schedule.scrapes >= SCHEDULE_MIN_SCRAPES && best_w * 100 >= s_schedule.weight * SCHEDULE_MIN_SHARE)
+    {
+        s_schedule.scrape_ms = best * bin_ms + bin_ms / 2;
+        int64_t lead = CONFIG_SAMPLE_PHASE_LEAD_MS + publish_ms;
+        s_schedule.target_ms = ((s_schedule.scrape_ms - lead) % interval + interval) % interval;
+    }
+    int32_t target = s_schedule.target_ms;
+    portEXIT_CRITICAL(&s_schedule_mux);
+
+    uint32_t wait = interval;
+    if(SCHEDULE_ALIGN && target >= 0)
+    {
+        uint32_t shift = (target + interval - schedule_phase(last_wake, interval)) % interval;
+        if(shift > bin_ms && shift < interval - bin_ms)
+        {
+            wait += shift;
+            portENTER_CRITICAL(&s_schedule_mux);
+            s_schedule.shifts++;
+            portEXIT_CRITICAL(&s_schedule_mux);
+        }
+    }
+    return pdMS_TO_TICKS(wait);
+}
+
+/*Learned scrape phase, the sampler's target and the age of the data at each scrape*/
+int debug_format_schedule(char *out, size_t len)
+{
+    portENTER_CRITICAL(&s_schedule_mux);
+    struct schedule_stats st = s_schedule;
+    portEXIT_CRITICAL(&s_schedule_mux);
+    int n = 0;
+    APPEND(out, len, n, "{\"interval_ms\":%u,\"scrapes\":%u,\"scrape_phase_ms\":%d,\"wake_phase_ms\":%d,\"align\":%s,\"shifts\":%u,\"phase\":[",
+           st.interval_ms, st.scrapes, st.scrape_ms, st.target_ms, SCHEDULE_ALIGN ? "true" : "false", st.shifts);
+    for(int i = 0; i < SCHEDULE_PHASE_BINS; i++)
+        APPEND(out, len, n, "%s%u", i ? "," : "", st.phase[i]);
+    APPEND(out, len, n, "],\"age_avg_ms\":%u,\"age_tenths_of_interval\":[",
+           st.age_count ? (uint32_t)(st.age_total_ms / st.age_count) : 0);
+    for(int i = 0; i < SCHEDULE_AGE_BUCKETS; i++)
+        APPEND(out, len, n, "%s%u", i ? "," : "", st.age[i]);
+    APPEND(out, len, n, "]}");
+    return n;
+}
+/*Schedule section END*/
+
+
+/*Sampler section START*/
+
+static StackType_t s_sampler_stack[CONFIG_SAMPLER_STACK_SIZE];
+static StaticTask_t s_sampler_tcb;
+static struct data s_latest = { .status = DHT_ERR_NO_DATA };
+static SemaphoreHandle_t s_ingest_lock;
+static StaticSemaphore_t s_ingest_lock_buf;
+
+static struct stats s_stats;
+#define SAMPLER_LISTENERS 2
+static TaskHandle_t s_listeners[SAMPLER_LISTENERS];
+
+/*Called with s_data_lock held*/
+static void stats_record_read(const struct data *sample, uint32_t duration_us)
+{
+    s_stats.reads++;
+    if(sample->status == DHT_ERR_CHECKSUM)
+        s_stats.checksum_errors++;
+    else if(sample->status == DHT_ERR_TIMEOUT)
+        s_stats.timeouts++;
+    s_stats.max_read_us = MAX(s_stats.max_read_us, duration_us);
+}
+
+/*Guards the history ring for readers that walk it with history_copy/history_get*/
+void sampler_lock(void)
+{
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+}
+
+void sampler_unlock(void)
+{
+    xSemaphoreGive(s_data_lock);
+}
+
+void sampler_get_stats(struct stats *out)
+{
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    *out = s_stats;
+    xSemaphoreGive(s_data_lock);
+}
+
+/*task gets a notification after every sample that reaches the history ring; called once per task at startup*/
+void sampler_add_listener(TaskHandle_t task)
+{
+    for(int i = 0; i < SAMPLER_LISTENERS; i++)
+        if(s_listeners[i] == NULL)
+        {
+            s_listeners[i] = task;
+            return;
+        }
+    ESP_LOGE(TAG, "no room for another sample listener");
+}
+
+void get_latest(struct data *out)
+{
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    *out = s_latest;
+    xSemaphoreGive(s_data_lock);
+}
+
+/*The RAM side of a sample, on the live state or the load generator's scratch copy; interval_ms is for the heatmap*/
+static void sampler_store(struct history_ring *history, struct heatmap_state *heatmap, const struct data *sample,
+                          uint32_t history_depth, uint32_t interval_ms)
+{
+    history_set_depth(history, history_depth);
+    if(sample->status == DHT_OK)
+    {
+        heatmap_add(heatmap, sample, interval_ms);
+        history_push(history, sample);
+    }
+}
+
+/*Where ingested samples go: the live state, or the load generator's scratch copies of it*/
+struct sampler_sink{
+    struct history_ring *history;
+    struct heatmap_state *heatmap;
+#if CONFIG_DHT_STORAGE_ENABLE
+    struct flashlog_bench *bench;     //NULL for the flash log
+#endif
+#if CONFIG_DHT_EXPORTERS_ENABLE
+    struct snapshot_set *snapshots;   //NULL for the served documents
+#endif
+};
+
+static const struct sampler_sink s_live_sink = { .history = &s_history, .heatmap = &s_heatmap };
+
+/*
+Everything downstream of a read: history, heatmap, flash log (and through it the rollups), the snapshot documents
+and the listeners. s_ingest_lock keeps the renderer of the served snapshots single. A scratch sink takes the same
+steps into its own copies; its listener wakeups find nothing new in the live ring. Returns the flash log result.
+*/
+static esp_err_t sampler_ingest(const struct sampler_sink *sink, const struct data *sample, uint32_t history_depth,
+                                uint32_t interval_ms)
+{
+    esp_err_t err = ESP_OK;
+    bool live = sink == &s_live_sink;
+    if(live)
+        xSemaphoreTake(s_ingest_lock, portMAX_DELAY);
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    sampler_store(sink->history, sink->heatmap, sample, history_depth, interval_ms);
+    xSemaphoreGive(s_data_lock);
+
+#if CONFIG_DHT_STORAGE_ENABLE
+    if(sample->status == DHT_OK && live)
+        err = flashlog_append(sample);
+#if CONFIG_LOADGEN_ENABLE
+    else if(sample->status == DHT_OK && sink->bench)
+        err = flashlog_bench_append(sink->bench, sample);
+#endif
+#endif
+
+#if CONFIG_DHT_EXPORTERS_ENABLE
+    struct stats st;
+    sampler_get_stats(&st);
+    if(live)
+        snapshot_publish(sample, &st);
+    else
+        snapshot_render(sink->snapshots, sample, &st);
+#endif
+    if(live)
+        xSemaphoreGive(s_ingest_lock);
+#if CONFIG_DHT_STORAGE_ENABLE
+    if(live)
+        rollup_notify();
+#endif
+    for(int i = 0; i < SAMPLER_LISTENERS && s_listeners[i] && sample->status == DHT_OK; i++)
+        xTaskNotifyGive(s_listeners[i]);
+    return err;
+}
+
+static void sampler_task(void *arg)
+{
+#if CONFIG_DHT_POWER_GATE
+    //power_init switched the sensor on just now
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_DHT_POWER_WARMUP_MS));
+#endif
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t last_ckpt = clock_wall_us(esp_timer_get_time()) / 1000000;
+
+    for(;;)
+    {
+        struct app_config cfg;
+        config_get(&cfg);
+        struct data sample;
+#if CONFIG_DHT_FUSION
+        fusion_sample(cfg.dht_pin, &sample);
+#else
+        dht_select_pin(cfg.dht_pin);
+        readSensor(&sample);
+        sample.sensor = 0;
+#endif
+        uint32_t duration_us = esp_timer_get_time() - sample.mono_us;
+        power_note_sample(duration_us);
+        int64_t now = clock_wall_us(sample.mono_us) / 1000000;
+
+        xSemaphoreTake(s_data_lock, portMAX_DELAY);
+        s_latest = sample;
+        stats_record_read(&sample, duration_us);
+        xSemaphoreGive(s_data_lock);
+        diag_record_read(&sample, duration_us);
+
+        if(sample.status != DHT_OK)
+            ESP_LOGW(TAG, "DHT11 error %d", sample.status);
+        if(sampler_ingest(&s_live_sink, &sample, cfg.history_depth, cfg.sample_interval_ms) != ESP_OK)
+        {
+            xSemaphoreTake(s_data_lock, portMAX_DELAY);
+            s_stats.flash_errors++;
+            xSemaphoreGive(s_data_lock);
+        }
+        uint32_t publish_ms = (esp_timer_get_time() - sample.mono_us) / 1000;
+
+        //checkpoint periodically and whenever the day rolls over so at most one interval of heatmap is lost
+        if(now - last_ckpt >= CONFIG_HEATMAP_PERSIST_INTERVAL_S || now / 86400 != last_ckpt / 86400)
+        {
+#if CONFIG_DHT_STORAGE_ENABLE
+            static struct heatmap snapshot;
+            heatmap_get(&snapshot);
+            esp_err_t err = flashlog_save_checkpoint(&snapshot, sizeof(snapshot));
+            if(err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "heatmap checkpoint failed: %s", esp_err_to_name(err));
+                xSemaphoreTake(s_data_lock, portMAX_DELAY);
+                s_stats.checkpoint_errors++;
+                xSemaphoreGive(s_data_lock);
+            }
+#endif
+            clock_persist();
+            last_ckpt = now;
+        }
+
+        TickType_t wait = schedule_next_wait(last_wake, cfg.sample_interval_ms, publish_ms);
+        capture_announce(esp_timer_get_time() + (int64_t)(int32_t)(last_wake + wait - xTaskGetTickCount()) * portTICK_PERIOD_MS * 1000);
+        power_delay_until(&last_wake, wait);
+    }
+}
+
+void start_sampler(void)
+{
+    s_data_lock = xSemaphoreCreateMutexStatic(&s_data_lock_buf);
+    s_ingest_lock = xSemaphoreCreateMutexStatic(&s_ingest_lock_buf);
+#if CONFIG_DHT_EXPORTERS_ENABLE
+    snapshot_init();
+#endif
+    power_init();
+#if CONFIG_DHT_FUSION
+    fusion_init();
+#endif
+    bool restored = false;
+#if CONFIG_DHT_STORAGE_ENABLE
+    restored = storage_init() == ESP_OK && flashlog_load_checkpoint(&s_heatmap.map, sizeof(s_heatmap.map)) == ESP_OK;
+    if(restored)
+        ESP_LOGI(TAG, "heatmap restored from checkpoint");
+#endif
+    //checkpoints from before HEATMAP_DAY_NONE mark empty rows as day 0; a failed load may leave a partial read
+    heatmap_clear_invalid(&s_heatmap.map, !restored);
+    xTaskCreateStaticPinnedToCore(sampler_task, "sampler", CONFIG_SAMPLER_STACK_SIZE, NULL, 5, s_sampler_stack, &s_sampler_tcb,
+                                  CONFIG_SAMPLER_CORE);
+}
+
+/*
+JSON renderers for the /api/v1/debug/ endpoints and the UART console, see the debug formatter section of
+dht_diag. Each writes at most len bytes (always terminated) and returns the length it would have needed.
+*/
+#define DEBUG_RING_SAMPLES 32
+
+int debug_format_stats(char *out, size_t len)
+{
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    struct stats st = s_stats;
+    uint32_t hist_count = history_count(), hist_depth = history_depth();
+    xSemaphoreGive(s_data_lock);
+#if CONFIG_DHT_STORAGE_ENABLE
+    struct flashlog_status log;
+    flashlog_get_status(&log);
+#endif
+
+    int n = 0;
+    APPEND(out, len, n, "{\"uptime_s\":%lld,\"reads\":%u,\"checksum_errors\":%u,\"timeouts\":%u,\"max_read_us\":%u,",
+           esp_timer_get_time() / 1000000, st.reads, st.checksum_errors, st.timeouts, st.max_read_us);
+    APPEND(out, len, n, "\"heap\":{\"free\":%u,\"min_free\":%u,\"largest_block\":%u},",
+           esp_get_free_heap_size(), esp_get_minimum_free_heap_size(), (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    APPEND(out, len, n, "\"history\":{\"count\":%u,\"depth\":%u},", hist_count, hist_depth);
+#if CONFIG_DHT_STORAGE_ENABLE
+    APPEND(out, len, n, "\"flashlog\":{\"sector\":%u,\"seq\":%u,\"record\":%u,\"errors\":%u,\"checkpoint_errors\":%u,\"torn\":%u,\"recovery_us\":%u},",
+           log.sector, log.seq, log.record, st.flash_errors, st.checkpoint_errors, log.torn, log.recovery_us);
+#endif
+    APPEND(out, len, n, "\"clock\":{\"synced\":%s,\"drift_ppb\":%d}}", clock_is_synced() ? "true" : "false", clock_drift_ppb());
+    return n;
+}
+
+int debug_format_sensor(char *out, size_t len)
+{
+    struct data last;
+    get_latest(&last);
+    int n = 0;
+    APPEND(out, len, n, "{\"pin\":%d,\"type\":\"%s\",\"capture\":\"%s\",\"status\":%u,", dht_pin(),
+           DHT_TYPE_NAME, DHT_CAPTURE_NAME, last.status);
+    APPEND(out, len, n, "\"temperature\":" TENTHS_FMT ",\"humidity\":" TENTHS_FMT ",\"age_ms\":%lld}",
+           TENTHS_ARGS(last.temperature), TENTHS_ARGS(last.humidity),
+           last.status == DHT_ERR_NO_DATA ? -1 : (esp_timer_get_time() - last.mono_us) / 1000);
+    return n;
+}
+
+/*Newest DEBUG_RING_SAMPLES entries of the history ring as [t_ms, temperature, humidity]*/
+int debug_format_ring(char *out, size_t len)
+{
+    struct data ring[DEBUG_RING_SAMPLES];
+    xSemaphoreTake(s_data_lock, portMAX_DELAY);
+    uint32_t count = history_count(), depth = history_depth();
+    uint32_t shown = MIN(count, DEBUG_RING_SAMPLES);
+    for(uint32_t i = 0; i < shown; i++)
+        history_get(count - shown + i, &ring[i]);
+    xSemaphoreGive(s_data_lock);
+
+    int n = 0;
+    APPEND(out, len, n, "{\"count\":%u,\"depth\":%u,\"samples\":[", count, depth);
+    for(uint32_t i = 0; i < shown; i++)
+        APPEND(out, len, n, "%s[%lld," TENTHS_FMT "," TENTHS_FMT "]", i ? "," : "",
+               ring[i].mono_us / 1000, TENTHS_ARGS(ring[i].temperature), TENTHS_ARGS(ring[i].humidity));
+    APPEND(out, len, n, "]}");
+    return n;
+}
+/*Sampler section END*/
+
+
+/*Load generator section START*/
+#if CONFIG_LOADGEN_ENABLE
+
+/*
+Synthetic sensors for finding where the pipeline saturates; a DHT11 only gives 1 Hz. Runs on the calling task and
+feeds every sample through sampler_ingest() into a scratch sink: a history ring and heatmap of the configured
+size, the flash bench area with its compaction, and a snapshot set, taking the locks the sampler takes. The
+listeners are woken as for a real sample. The live data, flash log, rollups and served snapshots never see a
+synthetic sample, and push finds none to send. A sample is dropped when its sensor comes due again before it was
+produced, as a real sensor's reading would be overwritten. CPU is the time spent ingesting against the run time,
+for one core.
+*/
+struct loadgen_sensor{
+    int64_t due_us;
+    int16_t temperature;
+    uint16_t humidity;
+};
+
+static void loadgen_free(struct loadgen_sensor *s, struct sampler_sink *sink)
+{
+    free(s);
+    free(sink->heatmap);
+    free(sink->history->slots);
+#if CONFIG_DHT_STORAGE_ENABLE
+    if(sink->bench)
+        flashlog_bench_close(sink->bench);
+#endif
+#if CONFIG_DHT_EXPORTERS_ENABLE
+    free(sink->snapshots);
+#endif
+}
+
+bool loadgen_run(int sensors, int hz, int seconds, struct loadgen_result *r)
+{
+    *r = (struct loadgen_result){ 0 };
+    uint32_t heap_before = esp_get_free_heap_size(), heap_min = heap_before;
+    struct app_config cfg;
+    config_get(&cfg);
+    struct loadgen_sensor *s = calloc(sensors, sizeof(*s));
+    struct heatmap_state *heatmap = calloc(1, sizeof(*heatmap));
+    struct history_ring history = { .slots = calloc(cfg.history_depth, sizeof(struct history_entry)), .depth = cfg.history_depth };
+    struct sampler_sink sink = { .history = &history, .heatmap = heatmap };
+    bool ok = s && heatmap && history.slots;
+#if CONFIG_DHT_STORAGE_ENABLE
+    //without a flash log there is nothing to bench either
+    sink.bench = flashlog_ready() ? flashlog_bench_open() : NULL;
+    ok = ok && (sink.bench || !flashlog_ready());
+    r->flash = sink.bench != NULL;
+#endif
+#if CONFIG_DHT_EXPORTERS_ENABLE
+    sink.snapshots = snapshot_set_alloc();
+    ok = ok && sink.snapshots;
+#endif
+    if(!ok)
+    {
+        loadgen_free(s, &sink);
+        return false;
+    }
+    heatmap->last_ms = -1;
+    heatmap_clear_invalid(&heatmap->map, true);
+    int64_t period_us = 1000000 / hz;
+    int64_t start = esp_timer_get_time(), end = start + seconds * 1000000LL, last_yield = start;
+    //staggered so the sensors do not all fall due in the same tick
+    for(int i = 0; i < sensors; i++)
+        s[i] = (struct loadgen_sensor){ .due_us = start + period_us * i / sensors, .temperature = 150 + i % 100, .humidity = 500 };
+
+    int64_t now;
+    while((now = esp_timer_get_time()) < end)
+    {
+        bool produced = false;
+        for(int i = 0; i < sensors; i++)
+        {
+            struct loadgen_sensor *g = &s[i];
+            if(g->due_us > now)
+                continue;
+            int64_t late = (now - g->due_us) / period_us;
+            r->dropped += late;
+            g->due_us += (late + 1) * period_us;
+            uint32_t rnd = esp_random();
+            g->temperature += (int)(rnd % 3) - 1;
+            g->humidity = MIN(1000, MAX(0, (int)g->humidity + (int)(rnd / 3 % 5) - 2));
+
+            int64_t t = esp_timer_get_time();
+            struct data sample = { .mono_us = t, .temperature = g->temperature, .humidity = g->humidity,
+                                   .status = DHT_OK, .sensor = LOADGEN_SENSOR_BASE + i };
+            if(sampler_ingest(&sink, &sample, cfg.history_depth, period_us / 1000) != ESP_OK)
+                r->flash_errors++;
+            uint32_t us = esp_timer_get_time() - t;
+            r->busy_us += us;
+            r->max_ingest_us = MAX(r->max_ingest_us, us);
+            r->samples++;
+            produced = true;
+        }
+        heap_min = MIN(heap_min, esp_get_free_heap_size());
+        //idle when nothing is due, and now and then under overload so the idle task still runs
+        if(!produced || now - last_yield > 100000)
+        {
+            vTaskDelay(1);
+            last_yield = esp_timer_get_time();
+        }
+    }
+    r->elapsed_us = esp_timer_get_time() - start;
+    //whatever is still due at the end was not produced in time either
+    for(int i = 0; i < sensors; i++)
+        if(s[i].due_us < start + r->elapsed_us)
+            r->dropped += (start + r->elapsed_us - s[i].due_us) / period_us;
+    r->heap_bytes = heap_before - heap_min;
+    loadgen_free(s, &sink);
+    return true;
+}
+
+#endif
+/*Load generator section END*/
@@ -0,0 +1,72 @@
+/*
+The sampler task and the RAM state it keeps: latest reading, read counters, history ring, heatmap and the
+learned scrape schedule. The load generator feeds the same pipeline with synthetic sensors.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "dht_core.h"
+
+/*Heatmap section*/
+#define HEATMAP_DAYS   CONFIG_HEATMAP_DAYS
+#define HEATMAP_BANDS  CONFIG_HEATMAP_BANDS
+#define HEATMAP_DAY_NONE UINT32_MAX   //day of a row that holds nothing
+
+struct heatmap{
+    uint32_t day[HEATMAP_DAYS];                 //day number (wall-clock seconds / 86400) each row holds, or HEATMAP_DAY_NONE
+    uint32_t ms[HEATMAP_DAYS][HEATMAP_BANDS];   //milliseconds spent in each band
+};
+
+void heatmap_get(struct heatmap *out);
+uint32_t heatmap_newest_day(void);
+bool heatmap_get_day(uint32_t day, uint32_t *ms);
+
+/*History section, called between sampler_lock() and sampler_unlock()*/
+uint32_t history_count(void);
+uint32_t history_depth(void);
+uint32_t history_seq(void);
+void history_get(uint32_t i, struct data *out);
+uint32_t history_copy(uint32_t *seq, struct data *out, uint32_t n);
+
+/*Schedule section*/
+void schedule_note_scrape(int64_t sample_us);
+int debug_format_schedule(char *out, size_t len);
+
+/*Sampler section*/
+struct stats{
+    uint32_t reads;
+    uint32_t checksum_errors;
+    uint32_t timeouts;
+    uint32_t flash_errors;
+    uint32_t checkpoint_errors;   //heatmap checkpoints not saved
+    uint32_t max_read_us;
+};
+
+void start_sampler(void);
+void sampler_lock(void);
+void sampler_unlock(void);
+void get_latest(struct data *out);
+void sampler_get_stats(struct stats *out);
+void sampler_add_listener(TaskHandle_t task);
+int debug_format_stats(char *out, size_t len);
+int debug_format_sensor(char *out, size_t len);
+int debug_format_ring(char *out, size_t len);
+
+/*Load generator section*/
+#if CONFIG_LOADGEN_ENABLE
+#define LOADGEN_MAX_HZ 50
+
+struct loadgen_result{
+    uint32_t samples;
+    uint32_t dropped;
+    uint32_t max_ingest_us;
+    int64_t busy_us;
+    int64_t elapsed_us;
+    uint32_t heap_bytes;    //state plus the largest drop in free heap during the run
+    bool flash;             //samples went to the flash bench, false without a flash log
+    uint32_t flash_errors;  //bench writes and compaction steps that failed
+};
+
+bool loadgen_run(int sensors, int hz, int seconds, struct loadgen_result *r);
+#endif
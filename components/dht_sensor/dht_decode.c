@@ -0,0 +1,79 @@
+/*
+Transfer decoding: run lengths to data bytes and data bytes to a reading. No hardware access, so this file also
+builds for the host tests in host_test/.
+*/
+
+#include <string.h>
+#include "dht_decode.h"
+
+/*Checksum and conversion of the 5 data bytes*/
+void dht_parse(const uint8_t *buf, struct data *temp)
+{
+    //If the data transmission is right, the check-sum should be the last 8bit of "8bit integral RH data + 8bit decimal RH data + 8bit integral T data + 8bit decimal T data".
+    if(buf[4] == (uint8_t)(buf[0]+buf[1]+buf[2]+buf[3]))
+        temp->status=DHT_OK; //no error
+    else
+        temp->status=DHT_ERR_CHECKSUM; //error
+#if CONFIG_DHT_SENSOR_DHT22
+    //DHT22: 16 bit tenths, temperature uses bit 15 as sign instead of two's complement
+    temp->humidity = (buf[0] << 8) | buf[1];
+    temp->temperature = ((buf[2] & 0x7f) << 8) | buf[3];
+    if(buf[2] & 0x80)
+        temp->temperature = -temp->temperature;
+#else
+    //DHT11: integral byte plus one decimal digit, newer parts flag negative temperatures with bit 7 of the decimal byte
+    temp->humidity = buf[0] * 10 + buf[1] % 10;
+    temp->temperature = buf[2] * 10 + (buf[3] & 0x0f) % 10;
+    if(buf[3] & 0x80)
+        temp->temperature = -temp->temperature;
+#endif
+}
+
+#define DHT_BIT_THRESHOLD_US  48  //a 0 is high for 26-28 us, a 1 for 70 us
+#define DHT_RESPONSE_MIN_US   60  //the response is 80 us low then 80 us high
+
+/*Next run with consecutive runs of the same level merged and empty ones dropped; false at the end*/
+static bool dht_next_run(const struct dht_run *runs, size_t n, size_t *pos, uint8_t *level, uint32_t *us)
+{
+    while(*pos < n && runs[*pos].us == 0)
+        (*pos)++;
+    if(*pos >= n)
+        return false;
+    *level = runs[*pos].level;
+    *us = 0;
+    while(*pos < n && (runs[*pos].us == 0 || runs[*pos].level == *level))
+        *us += runs[(*pos)++].us;
+    return true;
+}
+
+/*
+Run-length decode of a transfer into its 5 data bytes. Pure, no hardware access, so it runs the same on synthetic
+runs off target. Whatever precedes the response (the released line, the tail of the start signal) is skipped.
+Returns DHT_OK, or DHT_ERR_TIMEOUT when the response or any of the 40 bits is missing.
+*/
+int dht_decode_runs(const struct dht_run *runs, size_t n, uint8_t *out)
+{
+    size_t pos = 0;
+    uint8_t level, prev_level = 1;
+    uint32_t us, prev_us = 0;
+    bool synced = false;
+    while(!synced && dht_next_run(runs, n, &pos, &level, &us))
+    {
+        synced = prev_level == 0 && level == 1 && prev_us >= DHT_RESPONSE_MIN_US && us >= DHT_RESPONSE_MIN_US;
+        prev_level = level;
+        prev_us = us;
+    }
+    if(!synced)
+        return DHT_ERR_TIMEOUT;
+    memset(out, 0, 5);
+    for(int bit = 0; bit < 40; bit++)
+    {
+        //every bit is a low separator then a high level whose length is the value
+        if(!dht_next_run(runs, n, &pos, &level, &us) || level != 0)
+            return DHT_ERR_TIMEOUT;
+        if(!dht_next_run(runs, n, &pos, &level, &us) || level != 1)
+            return DHT_ERR_TIMEOUT;
+        out[bit / 8] = (out[bit / 8] << 1) | (us > DHT_BIT_THRESHOLD_US);
+    }
+    return DHT_OK;
+}
@@ -0,0 +1,634 @@
+/* 
+Main reference: https://www.mouser.com/datasheet/2/758/DHT11-Technical-Data-Sheet-Translated-Version-1143054.pdf
+Basic structure:
+1. MCU sends out start signal to dht11 by pulling down voltage for at least 18 ms
+2. MCU pulls up voltage and waits for dht11 to respond (20-40ms)
+3. DHT11 sends out low response signal for 80 us, then pulls up for 80us and readies for data transmission
+4. Data transmission is sent, total of 40 bits or 5 bytes. Data format: [int rh, float rh, int temp, float temp, checksum]
+   DHT22-class parts send 16-bit big-endian tenths instead: [rh high, rh low, temp high, temp low, checksum], bit 15 of temp is the sign.
+
+*/
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "driver/rmt.h"
+#include "hal/gpio_ll.h"
+#include "soc/gpio_struct.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
+#include "dht_sensor.h"
+
+#if CONFIG_DHT_POWER_ACTIVE_LOW
+#define POWER_ACTIVE_LOW true
+#else
+#define POWER_ACTIVE_LOW false
+#endif
+#if CONFIG_DHT_POWER_GATE
+#define POWER_GATED true
+#else
+#define POWER_GATED false
+#endif
+//longest level the DHT11 holds during a transfer is 80 us, anything well past that means the sensor is gone
+#define DHT_TIMEOUT_US  200
+
+static const char *TAG = "sensor";
+
+/*DHT11 section START*/
+
+static bool s_dht_timeout;
+static gpio_num_t s_dht_pin = GPIO_NUM_NC;  //set by the first dht_select_pin()
+static uint8_t s_dht_raw[5];  //bytes of the last transfer, kept for diagnostics
+/*Point the driver at the sensor on pin, the pin is configured on change only*/
+void dht_select_pin(gpio_num_t pin)
+{
+    if(pin == s_dht_pin)
+        return;
+    s_dht_pin = pin;
+    gpio_pad_select_gpio(s_dht_pin);
+}
+
+gpio_num_t dht_pin(void)
+{
+    return s_dht_pin;
+}
+
+/*Bytes of the last transfer, zero where it timed out*/
+void dht_last_raw(uint8_t *out)
+{
+    memcpy(out, s_dht_raw, sizeof(s_dht_raw));
+}
+
+/*
+Capture window: the sampler announces when its next transaction starts and readSensor clears it when done, so a
+sector erase from another task can wait until the read is over rather than hold the sampler and delay it.
+*/
+#define CAPTURE_WINDOW_US      30000   //start signal plus transfer
+#define CAPTURE_STALE_US       1000000 //an announced read this overdue is not coming, stop waiting for it
+#define FLASH_ERASE_BUDGET_US  100000  //a 4 KB sector erase typically takes 45 ms
+static portMUX_TYPE s_capture_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_capture_next_us;      //esp_timer start of the next transaction, 0 when none is pending
+static uint32_t s_capture_deferrals;
+
+void capture_announce(int64_t at_us)
+{
+    portENTER_CRITICAL(&s_capture_mux);
+    s_capture_next_us = at_us;
+    portEXIT_CRITICAL(&s_capture_mux);
+}
+
+static void capture_begin(void)
+{
+    portENTER_CRITICAL(&s_capture_mux);
+    if(s_capture_next_us == 0)
+        s_capture_next_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&s_capture_mux);
+}
+
+static void capture_end(void)
+{
+    capture_announce(0);
+}
+
+/*Called before a sector erase outside the sampler: hold it off while a transaction is due within the erase time*/
+void capture_wait_clear(void)
+{
+    bool deferred = false;
+    for(;;)
+    {
+        portENTER_CRITICAL(&s_capture_mux);
+        int64_t next = s_capture_next_us;
+        portEXIT_CRITICAL(&s_capture_mux);
+        int64_t ahead = next - esp_timer_get_time();
+        if(next == 0 || ahead > FLASH_ERASE_BUDGET_US || ahead < -CAPTURE_STALE_US)
+            break;
+        deferred = true;
+        vTaskDelay(pdMS_TO_TICKS((MAX(ahead, 0) + CAPTURE_WINDOW_US) / 1000) + 1);
+    }
+    s_capture_deferrals += deferred;
+}
+
+uint32_t capture_deferrals(void)
+{
+    return s_capture_deferrals;
+}
+
+#if CONFIG_DHT_CAPTURE_RMT
+/*
+RMT capture: the receiver times every level of the line in hardware and hands over the run lengths once the line
+has been idle for DHT_TIMEOUT_US, so neither CPU load, interrupt latency nor a flash operation can skew a bit.
+*/
+#define DHT_RMT_CHANNEL   RMT_CHANNEL_4
+#define DHT_RMT_RUNS      128  //one memory block, a transfer is about 84 runs
+
+static RingbufHandle_t s_dht_rmt_rb;
+static gpio_num_t s_dht_rmt_pin = GPIO_NUM_NC;
+static struct dht_run s_dht_runs[DHT_RMT_RUNS];
+
+/*Configure the receiver on pin, installing the driver the first time*/
+static esp_err_t dht_rmt_attach(gpio_num_t pin)
+{
+    esp_err_t err;
+    if(s_dht_rmt_rb == NULL)
+    {
+        rmt_config_t cfg = RMT_DEFAULT_CONFIG_RX(pin, DHT_RMT_CHANNEL);
+        cfg.clk_div = 80;                         //1 us ticks
+        cfg.rx_config.filter_en = true;
+        cfg.rx_config.filter_ticks_thresh = 100;  //APB cycles, drops glitches under 1.25 us
+        cfg.rx_config.idle_threshold = DHT_TIMEOUT_US;
+        err = rmt_config(&cfg);
+        if(err == ESP_OK)
+            err = rmt_driver_install(DHT_RMT_CHANNEL, DHT_RMT_RUNS / 2 * sizeof(rmt_item32_t) * 4, 0);
+        if(err == ESP_OK)
+            err = rmt_get_ringbuf_handle(DHT_RMT_CHANNEL, &s_dht_rmt_rb);
+    }
+    else
+        err = rmt_set_gpio(DHT_RMT_CHANNEL, RMT_MODE_RX, pin, false);
+    s_dht_rmt_pin = err == ESP_OK ? pin : GPIO_NUM_NC;
+    return err;
+}
+
+/*Full transaction: start signal, then the receiver records the response and the 40 bits*/
+void readSensor(struct data *temp)
+{
+    temp->mono_us = esp_timer_get_time();
+    memset(s_dht_raw, 0, sizeof(s_dht_raw));
+    s_dht_timeout = true;
+    temp->status = DHT_ERR_TIMEOUT;
+    if(s_dht_rmt_pin != s_dht_pin && dht_rmt_attach(s_dht_pin) != ESP_OK)
+        return;
+    capture_begin();
+    //the receiver stays on the pin through the GPIO matrix while the start signal is driven
+    gpio_set_direction(s_dht_pin, GPIO_MODE_INPUT_OUTPUT);
+    gpio_set_level(s_dht_pin, 0);
+    ets_delay_us(19*1000);
+    //start receiving just before the release so nothing of the response is missed; the idle timeout ends it
+    rmt_rx_start(DHT_RMT_CHANNEL, true);
+    gpio_set_level(s_dht_pin, 1);
+    gpio_set_direction(s_dht_pin, GPIO_MODE_INPUT);
+
+    size_t size = 0, n = 0;
+    rmt_item32_t *items = xRingbufferReceive(s_dht_rmt_rb, &size, pdMS_TO_TICKS(20));
+    rmt_rx_stop(DHT_RMT_CHANNEL);
+    capture_end();
+    if(items == NULL)
+        return;
+    for(size_t i = 0; i < size / sizeof(*items) && n + 2 <= DHT_RMT_RUNS; i++)
+    {
+        s_dht_runs[n++] = (struct dht_run){ .us = items[i].duration0, .level = items[i].level0 };
+        s_dht_runs[n++] = (struct dht_run){ .us = items[i].duration1, .level = items[i].level1 };
+    }
+    vRingbufferReturnItem(s_dht_rmt_rb, items);
+
+    uint8_t buf[5];
+    if(dht_decode_runs(s_dht_runs, n, buf) != DHT_OK)
+        return;
+    s_dht_timeout = false;
+    memcpy(s_dht_raw, buf, sizeof(s_dht_raw));
+    dht_parse(buf, temp);
+}
+#else
+/*
+Everything from releasing the line to the last bit runs with interrupts off on this core and from IRAM: startSignal,
+readData, waitWhileLevel and getData are IRAM_ATTR, the rest is ROM or inline. A flash write or erase started on the
+other core has to stall this core first, so it waits for the transfer to end instead of freezing it mid-bit, and one
+already running holds the sampler before the line is released. The window is up to about 5 ms, which is why the
+sampler is pinned to SAMPLER_CORE, away from the Wi-Fi stack on core 0.
+*/
+static portMUX_TYPE s_dht_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/*Busy wait while the data line stays at level, flags a timeout instead of hanging if the sensor stops responding*/
+static IRAM_ATTR void waitWhileLevel(int level)
+{
+    //after a timeout the rest of the transfer is lost anyway, do not wait it out with interrupts off
+    if(s_dht_timeout)
+        return;
+    int64_t start = esp_timer_get_time();
+    while(gpio_ll_get_level(&GPIO, s_dht_pin) == level)
+    {
+        if(esp_timer_get_time() - start > DHT_TIMEOUT_US)
+        {
+            s_dht_timeout = true;
+            return;
+        }
+    }
+}
+
+/*MCU sends out start signal to dht and dht responds. Returns inside s_dht_mux, getData or the caller leaves it*/
+IRAM_ATTR void startSignal(void)
+{ 
+    s_dht_timeout = false;
+    //set pin to ouput, pull down for at least 18 ms to let dht11 detect signal; input stays enabled so releasing the line is one register write
+    gpio_set_direction(s_dht_pin, GPIO_MODE_INPUT_OUTPUT);;      
+    gpio_set_level(s_dht_pin, 0);;       
+    ets_delay_us(19*1000); //19ms   
+
+    //pull up and wait for senor response (20-40 us)
+    portENTER_CRITICAL(&s_dht_mux);
+    gpio_ll_set_level(&GPIO, s_dht_pin, 1);
+    ets_delay_us(30);
+    gpio_ll_output_disable(&GPIO, s_dht_pin);
+
+    //dht first sends out response signal then pulls up voltage before starting data transmission
+    waitWhileLevel(0);
+    waitWhileLevel(1);
+}
+
+/*
+Read one byte/8 bit of DHT11 data transmission. Starts with 50 us of low voltage to signal new data then a high voltage for data.
+High voltage length of 26-28 us means "0", high voltage length greater than that is 1.
+*/
+IRAM_ATTR uint8_t readData(void)
+{ 
+    uint8_t i,sbuf=0;
+    for(i=0;i<8;i++)
+    {
+        //shift left by 1 to append new data transmission to least significant bit, eg. 00000001 becomes 00000010
+        sbuf<<=1;
+        //data transmission starts with low voltage level as signal so we skip this, then we add 30 us delay so that if data is 0 (26-28 us) then voltage after 30 us will pull down to 0
+        waitWhileLevel(0);
+        ets_delay_us(30);
+        //if high voltage after 30us, data was 1. Bitwise OR done so 1 bit will be added to the least significant bit eg. 00000010 becomes 00000011
+        if(gpio_ll_get_level(&GPIO, s_dht_pin))
+        {
+            sbuf|=1;  
+        }
+        //if voltage after 30 us is 0, then data was 0. Bitwise OR will be done basically making the least significant bit 0 eg. 00000010 becomes 00000010
+        else
+        {
+            sbuf|=0;
+        }
+        //
+        waitWhileLevel(1);
+    }
+    return sbuf;   
+}
+/*Use readvalue function to get the 5 bytes needed*/
+IRAM_ATTR void getData(struct data *temp)
+{
+    uint8_t buf[5]={0};
+
+    buf[0]=readData();
+    buf[1]=readData();
+    buf[2]=readData();
+    buf[3]=readData();
+    buf[4] =readData();
+    portEXIT_CRITICAL(&s_dht_mux);
+    memcpy(s_dht_raw, buf, sizeof(s_dht_raw));
+
+    if(s_dht_timeout)
+    {
+        temp->status=DHT_ERR_TIMEOUT;
+        return;
+    }
+    dht_parse(buf, temp);
+} 
+
+/*Full transaction: start signal then the 5 data bytes*/
+void readSensor(struct data *temp)
+{
+    temp->mono_us = esp_timer_get_time();
+    memset(s_dht_raw, 0, sizeof(s_dht_raw));
+    capture_begin();
+    startSignal();
+    if(s_dht_timeout)
+    {
+        portEXIT_CRITICAL(&s_dht_mux);
+        capture_end();
+        temp->status=DHT_ERR_TIMEOUT;
+        return;
+    }
+    getData(temp);
+    capture_end();
+}
+#endif
+/*DHT11 section END*/
+
+/*Power section START*/
+
+/*
+With DHT_POWER_GATE the sensor is supplied from DHT_POWER_PIN, directly or through a load switch, only around
+reads. It needs DHT_POWER_WARMUP_MS after power-up before it answers reliably, so the sampler wakes that much early
+to switch it on and the read itself stays on schedule. Energy per sample is estimated from the time the sensor is
+powered and the time it spends in transfers, with the datasheet currents set in menuconfig.
+*/
+#define POWER_GATE_MIN_OFF_MS 200  //shorter gaps are not worth a power cycle
+
+struct power_stats{
+    uint32_t samples;
+    uint32_t cycles;      //power-ups
+    uint64_t on_us;       //time powered
+    uint64_t read_us;     //time in transfers
+    uint64_t total_uj;
+    uint32_t last_uj;
+};
+
+static portMUX_TYPE s_power_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct power_stats s_power_stats;
+static bool s_power_on;
+static int64_t s_power_mark_us;    //last time on_us was brought up to date
+static int64_t s_power_start_us;
+static uint64_t s_power_noted_on_us;
+
+static void power_account(int64_t now)
+{
+    if(s_power_on)
+        s_power_stats.on_us += now - s_power_mark_us;
+    s_power_mark_us = now;
+}
+
+/*uA * mV * us / 1e9 = uJ for a sensor powered for on_us, read_us of it in transfers*/
+static uint64_t power_energy_uj(uint64_t on_us, uint64_t read_us)
+{
+    return ((uint64_t)CONFIG_DHT_STANDBY_UA * (on_us - read_us) + (uint64_t)CONFIG_DHT_MEASURE_UA * read_us) *
+           CONFIG_DHT_SUPPLY_MV / 1000000000;
+}
+
+/*Switch the sensor supply; without DHT_POWER_GATE it is always on and only the accounting runs*/
+void power_set(bool on)
+{
+#if CONFIG_DHT_POWER_GATE
+    if(on == s_power_on)
+        return;
+    //an unpowered sensor must not be fed through a data line driven high
+    if(!on)
+        gpio_set_direction(s_dht_pin, GPIO_MODE_INPUT);
+    gpio_set_level(CONFIG_DHT_POWER_PIN, on != POWER_ACTIVE_LOW);
+#endif
+    portENTER_CRITICAL(&s_power_mux);
+    power_account(esp_timer_get_time());
+    s_power_stats.cycles += on && !s_power_on;
+    s_power_on = on;
+    portEXIT_CRITICAL(&s_power_mux);
+}
+
+/*Charge the energy used since the previous sample to this one, read_us being its transfer time*/
+void power_note_sample(uint32_t read_us)
+{
+    portENTER_CRITICAL(&s_power_mux);
+    power_account(esp_timer_get_time());
+    uint64_t on_us = s_power_stats.on_us - s_power_noted_on_us;
+    s_power_noted_on_us = s_power_stats.on_us;
+    read_us = MIN(read_us, on_us);
+    uint64_t uj = power_energy_uj(on_us, read_us);
+    s_power_stats.samples++;
+    s_power_stats.read_us += read_us;
+    s_power_stats.total_uj += uj;
+    s_power_stats.last_uj = uj;
+    portEXIT_CRITICAL(&s_power_mux);
+}
+
+/*
+Sleep wait ticks from last_wake like vTaskDelayUntil. With power gating the sensor is off for the gap and back on
+DHT_POWER_WARMUP_MS before the end of it, unless the gap is too short to be worth it.
+*/
+void power_delay_until(TickType_t *last_wake, TickType_t wait)
+{
+#if CONFIG_DHT_POWER_GATE
+    TickType_t warmup = pdMS_TO_TICKS(CONFIG_DHT_POWER_WARMUP_MS);
+    if(wait > warmup + pdMS_TO_TICKS(POWER_GATE_MIN_OFF_MS))
+    {
+        power_set(false);
+        vTaskDelayUntil(last_wake, wait - warmup);
+        power_set(true);
+        wait = warmup;
+    }
+#endif
+    vTaskDelayUntil(last_wake, wait);
+}
+
+void power_init(void)
+{
+#if CONFIG_DHT_POWER_GATE
+    gpio_reset_pin(CONFIG_DHT_POWER_PIN);
+    gpio_set_direction(CONFIG_DHT_POWER_PIN, GPIO_MODE_OUTPUT);
+    gpio_set_level(CONFIG_DHT_POWER_PIN, POWER_ACTIVE_LOW);
+#endif
+    s_power_start_us = s_power_mark_us = esp_timer_get_time();
+    power_set(true);
+}
+
+int debug_format_power(char *out, size_t len)
+{
+    portENTER_CRITICAL(&s_power_mux);
+    power_account(esp_timer_get_time());
+    struct power_stats st = s_power_stats;
+    bool on = s_power_on;
+    portEXIT_CRITICAL(&s_power_mux);
+    int64_t uptime_us = esp_timer_get_time();
+    //the same reads with the sensor powered the whole time
+    uint64_t ungated_uj = power_energy_uj(MAX(uptime_us - s_power_start_us, (int64_t)st.read_us), st.read_us);
+    int n = 0;
+    APPEND(out, len, n, "{\"gated\":%s,", POWER_GATED ? "true" : "false");
+#if CONFIG_DHT_POWER_GATE
+    APPEND(out, len, n, "\"pin\":%d,\"warmup_ms\":%d,", CONFIG_DHT_POWER_PIN, CONFIG_DHT_POWER_WARMUP_MS);
+#endif
+    APPEND(out, len, n, "\"on\":%s,\"cycles\":%u,\"samples\":%u,\"on_permille\":%u,\"read_permille\":%u,",
+           on ? "true" : "false", st.cycles, st.samples, (uint32_t)(st.on_us * 1000 / MAX(uptime_us, 1)),
+           (uint32_t)(st.read_us * 1000 / MAX(uptime_us, 1)));
+    APPEND(out, len, n, "\"energy_uj\":{\"last\":%u,\"avg\":%u},\"avg_power_uw\":%u,", st.last_uj,
+           st.samples ? (uint32_t)(st.total_uj / st.samples) : 0, (uint32_t)(st.total_uj * 1000000 / MAX(uptime_us, 1)));
+    APPEND(out, len, n, "\"ungated\":{\"energy_uj_avg\":%u,\"avg_power_uw\":%u}}",
+           st.samples ? (uint32_t)(ungated_uj / st.samples) : 0, (uint32_t)(ungated_uj * 1000000 / MAX(uptime_us, 1)));
+    return n;
+}
+/*Power section END*/
+
+/*Fusion section START*/
+#if CONFIG_DHT_FUSION
+/*
+Several sensors watching the same space: the sensor on the configured pin plus those on DHT_FUSION_PINS are read
+back to back in every sampler pass and fused into one virtual sensor, which is the sample the sampler publishes
+(latest reading, history, flash log, /metrics). Readings further than DHT_FUSION_MAX_DEV_* from the median of the
+pass are rejected, the rest is averaged with the top and bottom quarter trimmed. Each sensor keeps a running
+score of its distance to the fused value, so a drifting part shows up before it gets rejected outright.
+*/
+#define FUSION_MAX_SENSORS 8
+
+struct fusion_sensor{
+    gpio_num_t pin;
+    struct data last;
+    uint32_t reads;
+    uint32_t failures;    //checksum errors and timeouts
+    uint32_t rejections;  //outliers left out of the fused value
+    int32_t dev_t;        //running mean of |reading - fused|, tenths << 4
+    int32_t dev_h;
+};
+
+struct fusion_pass{
+    uint8_t used;
+    int16_t spread_t;     //max - min of the readings used, tenths
+    uint16_t spread_h;
+};
+
+static portMUX_TYPE s_fusion_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct fusion_sensor s_fusion[FUSION_MAX_SENSORS];
+static int s_fusion_count;
+static struct fusion_pass s_fusion_pass;
+
+static int fusion_cmp(const void *a, const void *b)
+{
+    return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+/*Median of n values, reordering them*/
+static int32_t fusion_median(int32_t *v, int n)
+{
+    qsort(v, n, sizeof(*v), fusion_cmp);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/*Mean of the n sorted values without the top and bottom quarter, 3 values give their median*/
+static int32_t fusion_trimmed_mean(const int32_t *v, int n)
+{
+    int trim = (n + 1) / 4;
+    int32_t sum = 0;
+    for(int i = trim; i < n - trim; i++)
+        sum += v[i];
+    return sum / (n - 2 * trim);
+}
+
+/*Sensor 0 is on the configured pin, the others on DHT_FUSION_PINS*/
+void fusion_init(void)
+{
+    s_fusion_count = 1;
+    s_fusion[0].pin = GPIO_NUM_NC;
+    const char *p = CONFIG_DHT_FUSION_PINS;
+    while(*p && s_fusion_count < FUSION_MAX_SENSORS)
+    {
+        char *end;
+        long pin = strtol(p, &end, 10);
+        if(end == p)
+        {
+            p++;
+            continue;
+        }
+        s_fusion[s_fusion_count++].pin = pin;
+        gpio_pad_select_gpio(pin);
+        p = end;
+    }
+    ESP_LOGI(TAG, "fusing %d sensors", s_fusion_count);
+}
+
+/*Read every sensor and fuse the good readings into out*/
+void fusion_sample(gpio_num_t pin0, struct data *out)
+{
+    struct data reads[FUSION_MAX_SENSORS];
+    s_fusion[0].pin = pin0;
+    int64_t start = esp_timer_get_time();
+    for(int i = 0; i < s_fusion_count; i++)
+    {
+        dht_select_pin(s_fusion[i].pin);
+        readSensor(&reads[i]);
+        reads[i].sensor = i;
+    }
+    //leave the configured sensor selected for dht_pin() and the diagnostics that read it
+    dht_select_pin(pin0);
+
+    int32_t t[FUSION_MAX_SENSORS], h[FUSION_MAX_SENSORS];
+    int n = 0;
+    for(int i = 0; i < s_fusion_count; i++)
+    {
+        if(reads[i].status != DHT_OK)
+            continue;
+        t[n] = reads[i].temperature;
+        h[n++] = reads[i].humidity;
+    }
+    *out = (struct data){ .mono_us = start, .sensor = FUSION_SENSOR_ID, .status = DHT_ERR_TIMEOUT };
+    for(int i = 0; i < s_fusion_count; i++)
+        if(reads[i].status == DHT_ERR_CHECKSUM)
+            out->status = DHT_ERR_CHECKSUM;
+    bool rejected[FUSION_MAX_SENSORS] = { false };
+    struct fusion_pass pass = { 0 };
+    if(n > 0)
+    {
+        int32_t med_t = fusion_median(t, n), med_h = fusion_median(h, n);
+        n = 0;
+        for(int i = 0; i < s_fusion_count; i++)
+        {
+            if(reads[i].status != DHT_OK)
+                continue;
+            rejected[i] = abs(reads[i].temperature - med_t) > CONFIG_DHT_FUSION_MAX_DEV_T ||
+                          abs(reads[i].humidity - med_h) > CONFIG_DHT_FUSION_MAX_DEV_H;
+            if(rejected[i])
+                continue;
+            t[n] = reads[i].temperature;
+            h[n++] = reads[i].humidity;
+        }
+        //no majority (eg. two sensors far apart): trust the one that has agreed best so far
+        if(n == 0)
+        {
+            int best = -1;
+            for(int i = 0; i < s_fusion_count; i++)
+                if(reads[i].status == DHT_OK && (best < 0 || s_fusion[i].dev_t + s_fusion[i].dev_h < s_fusion[best].dev_t + s_fusion[best].dev_h))
+                    best = i;
+            rejected[best] = false;
+            t[n] = reads[best].temperature;
+            h[n++] = reads[best].humidity;
+        }
+        qsort(t, n, sizeof(t[0]), fusion_cmp);
+        qsort(h, n, sizeof(h[0]), fusion_cmp);
+        out->temperature = fusion_trimmed_mean(t, n);
+        out->humidity = fusion_trimmed_mean(h, n);
+        out->status = DHT_OK;
+        pass = (struct fusion_pass){ .used = n, .spread_t = t[n - 1] - t[0], .spread_h = h[n - 1] - h[0] };
+    }
+
+    portENTER_CRITICAL(&s_fusion_mux);
+    s_fusion_pass = pass;
+    for(int i = 0; i < s_fusion_count; i++)
+    {
+        struct fusion_sensor *f = &s_fusion[i];
+        f->last = reads[i];
+        f->reads++;
+        if(reads[i].status != DHT_OK)
+        {
+            f->failures++;
+            continue;
+        }
+        f->rejections += rejected[i];
+        if(out->status == DHT_OK)
+        {
+            f->dev_t += abs(reads[i].temperature - out->temperature) - (f->dev_t >> 4);
+            f->dev_h += abs(reads[i].humidity - out->humidity) - (f->dev_h >> 4);
+        }
+    }
+    portEXIT_CRITICAL(&s_fusion_mux);
+}
+
+/*Latest reading of physical sensor i*/
+bool fusion_get(int i, struct data *out)
+{
+    if(i < 0 || i >= s_fusion_count)
+        return false;
+    portENTER_CRITICAL(&s_fusion_mux);
+    *out = s_fusion[i].last;
+    portEXIT_CRITICAL(&s_fusion_mux);
+    return true;
+}
+
+int debug_format_fusion(char *out, size_t len)
+{
+    struct fusion_sensor sensors[FUSION_MAX_SENSORS];
+    portENTER_CRITICAL(&s_fusion_mux);
+    memcpy(sensors, s_fusion, sizeof(sensors));
+    struct fusion_pass pass = s_fusion_pass;
+    portEXIT_CRITICAL(&s_fusion_mux);
+    int n = 0;
+    APPEND(out, len, n, "{\"used\":%u,\"spread_t\":" TENTHS_FMT ",\"spread_h\":" TENTHS_FMT ",\"sensors\":[",
+           pass.used, TENTHS_ARGS(pass.spread_t), TENTHS_ARGS(pass.spread_h));
+    for(int i = 0; i < s_fusion_count; i++)
+    {
+        const struct fusion_sensor *f = &sensors[i];
+        APPEND(out, len, n, "%s{\"id\":%d,\"pin\":%d,\"status\":%u,\"temperature\":" TENTHS_FMT ",\"humidity\":" TENTHS_FMT ","
+               "\"reads\":%u,\"failures\":%u,\"rejections\":%u,\"dev_t\":" TENTHS_FMT ",\"dev_h\":" TENTHS_FMT "}", i ? "," : "",
+               i, f->pin, f->last.status, TENTHS_ARGS(f->last.temperature), TENTHS_ARGS(f->last.humidity), f->reads, f->failures,
+               f->rejections, TENTHS_ARGS(f->dev_t >> 4), TENTHS_ARGS(f->dev_h >> 4));
+    }
+    APPEND(out, len, n, "]}");
+    return n;
+}
+#endif
+/*Fusion section END*/
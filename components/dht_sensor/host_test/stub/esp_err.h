@@ -0,0 +1,3 @@
+/*Host stand-in for the IDF header dht_core.h includes*/
+#pragma once
+typedef int esp_err_t;
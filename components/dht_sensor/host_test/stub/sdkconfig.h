@@ -0,0 +1,2 @@
+/*Host stand-in, the sensor type comes from the Makefile*/
+#pragma once
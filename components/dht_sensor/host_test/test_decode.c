@@ -0,0 +1,129 @@
+/*
+Host tests for dht_decode_runs and dht_parse on synthetic transfers. Build and run with make in this directory.
+*/
+
+#include <string.h>
+#include "dht_decode.h"
+
+#define RUNS_MAX 128
+
+static int s_failures;
+
+#define CHECK(cond) do{ if(!(cond)){ printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); s_failures++; } }while(0)
+
+#if CONFIG_DHT_SENSOR_DHT22
+#define TYPE_NAME "DHT22"
+//55.0 %RH, -10.1 C
+static const uint8_t FRAME[5] = { 0x02, 0x26, 0x80, 0x65, 0x0d };
+#else
+#define TYPE_NAME "DHT11"
+//55.0 %RH, 23.4 C
+static const uint8_t FRAME[5] = { 55, 0, 23, 4, 82 };
+#endif
+
+/*Runs of a transfer as the RMT receiver sees it: released line, response, 40 bits, final low*/
+static size_t frame_runs(const uint8_t *bytes, uint16_t response_us, struct dht_run *runs)
+{
+    size_t n = 0;
+    runs[n++] = (struct dht_run){ .us = 30, .level = 1 };
+    runs[n++] = (struct dht_run){ .us = response_us, .level = 0 };
+    runs[n++] = (struct dht_run){ .us = response_us, .level = 1 };
+    for(int bit = 0; bit < 40; bit++)
+    {
+        runs[n++] = (struct dht_run){ .us = 50, .level = 0 };
+        runs[n++] = (struct dht_run){ .us = (bytes[bit / 8] >> (7 - bit % 8)) & 1 ? 70 : 27, .level = 1 };
+    }
+    runs[n++] = (struct dht_run){ .us = 50, .level = 0 };
+    return n;
+}
+
+static void test_valid_frame(void)
+{
+    struct dht_run runs[RUNS_MAX];
+    size_t n = frame_runs(FRAME, 80, runs);
+    uint8_t buf[5];
+    CHECK(dht_decode_runs(runs, n, buf) == DHT_OK);
+    CHECK(memcmp(buf, FRAME, 5) == 0);
+    struct data d = { 0 };
+    dht_parse(buf, &d);
+    CHECK(d.status == DHT_OK);
+    CHECK(d.humidity == 550);
+#if CONFIG_DHT_SENSOR_DHT22
+    CHECK(d.temperature == -101);
+#else
+    CHECK(d.temperature == 234);
+#endif
+}
+
+/*The receiver pads items with empty runs and may split a level in two, neither changes the bits*/
+static void test_split_runs(void)
+{
+    struct dht_run runs[RUNS_MAX], split[RUNS_MAX + 4];
+    size_t n = frame_runs(FRAME, 80, runs), m = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        //split the low separator of bit 3
+        if(i == 9)
+        {
+            split[m++] = (struct dht_run){ .us = 20, .level = runs[i].level };
+            split[m++] = (struct dht_run){ .us = 0, .level = !runs[i].level };
+            split[m++] = (struct dht_run){ .us = runs[i].us - 20, .level = runs[i].level };
+        }
+        else
+            split[m++] = runs[i];
+    }
+    split[m++] = (struct dht_run){ .us = 0, .level = 0 };
+    uint8_t buf[5];
+    CHECK(dht_decode_runs(split, m, buf) == DHT_OK);
+    CHECK(memcmp(buf, FRAME, 5) == 0);
+}
+
+static void test_bad_checksum(void)
+{
+    uint8_t bytes[5];
+    memcpy(bytes, FRAME, 5);
+    bytes[4] ^= 0x01;
+    struct dht_run runs[RUNS_MAX];
+    size_t n = frame_runs(bytes, 80, runs);
+    uint8_t buf[5];
+    //the decoder hands over the bits as received, the checksum is dht_parse's job
+    CHECK(dht_decode_runs(runs, n, buf) == DHT_OK);
+    CHECK(memcmp(buf, bytes, 5) == 0);
+    struct data d = { 0 };
+    dht_parse(buf, &d);
+    CHECK(d.status == DHT_ERR_CHECKSUM);
+}
+
+static void test_missing_sync(void)
+{
+    struct dht_run runs[RUNS_MAX];
+    uint8_t buf[5];
+    //a response too short to be one
+    size_t n = frame_runs(FRAME, 30, runs);
+    CHECK(dht_decode_runs(runs, n, buf) == DHT_ERR_TIMEOUT);
+    //no response at all, only the released line
+    CHECK(dht_decode_runs(runs, 1, buf) == DHT_ERR_TIMEOUT);
+    CHECK(dht_decode_runs(runs, 0, buf) == DHT_ERR_TIMEOUT);
+}
+
+static void test_truncated_frame(void)
+{
+    struct dht_run runs[RUNS_MAX];
+    size_t n = frame_runs(FRAME, 80, runs);
+    uint8_t buf[5];
+    //the last bit's high level is missing
+    CHECK(dht_decode_runs(runs, n - 2, buf) == DHT_ERR_TIMEOUT);
+    //the receiver ran out of memory blocks half way
+    CHECK(dht_decode_runs(runs, n / 2, buf) == DHT_ERR_TIMEOUT);
+}
+
+int main(void)
+{
+    test_valid_frame();
+    test_split_runs();
+    test_bad_checksum();
+    test_missing_sync();
+    test_truncated_frame();
+    printf("%s: %s\n", TYPE_NAME, s_failures ? "FAILED" : "ok");
+    return s_failures != 0;
+}
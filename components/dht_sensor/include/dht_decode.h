@@ -0,0 +1,16 @@
+/*
+Pure decoding of a DHT transfer, shared by the capture backends and the host tests.
+*/
+#pragma once
+
+#include <stddef.h>
+#include "dht_core.h"
+
+/*One level of the data line and how long it lasted*/
+struct dht_run{
+    uint16_t us;
+    uint8_t level;
+};
+
+int dht_decode_runs(const struct dht_run *runs, size_t n, uint8_t *out);
+void dht_parse(const uint8_t *buf, struct data *temp);
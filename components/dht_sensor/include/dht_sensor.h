@@ -0,0 +1,44 @@
+/*
+DHT11/DHT22 driver: start signal and bit capture (polled or RMT), supply gating and multi-sensor fusion.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "dht_core.h"
+#include "dht_decode.h"
+
+#if CONFIG_DHT_SENSOR_DHT22
+#define DHT_TYPE_NAME "DHT22"
+#else
+#define DHT_TYPE_NAME "DHT11"
+#endif
+#if CONFIG_DHT_CAPTURE_RMT
+#define DHT_CAPTURE_NAME "rmt"
+#else
+#define DHT_CAPTURE_NAME "poll"
+#endif
+
+/*DHT11 section*/
+void dht_select_pin(gpio_num_t pin);
+gpio_num_t dht_pin(void);
+void dht_last_raw(uint8_t *out);
+void capture_announce(int64_t at_us);
+void capture_wait_clear(void);
+uint32_t capture_deferrals(void);
+void readSensor(struct data *temp);
+
+/*Power section*/
+void power_init(void);
+void power_set(bool on);
+void power_note_sample(uint32_t read_us);
+void power_delay_until(TickType_t *last_wake, TickType_t wait);
+int debug_format_power(char *out, size_t len);
+
+/*Fusion section*/
+#if CONFIG_DHT_FUSION
+void fusion_init(void);
+void fusion_sample(gpio_num_t pin0, struct data *out);
+bool fusion_get(int i, struct data *out);
+int debug_format_fusion(char *out, size_t len);
+#endif
@@ -0,0 +1,1118 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "esp_crc.h"
+#include "dht_sensor.h"
+#include "dht_storage.h"
+
+static const char *TAG = "storage";
+
+/*Flash log section START*/
+
+/*
+Samples are appended to the "datalog" partition (see partitions.csv) as a ring of 4 KB sectors.
+Sectors 0 and 1 hold heatmap checkpoints written ping-pong, then come the raw sample records, with LOADGEN_ENABLE
+the load generator's bench area (see the Bench section) and, with FLASHLOG_COMPACT, the rollup tiers at the end
+of the partition (see the Rollup section).
+Every log sector starts with a header carrying the wall-clock time of its first record; records are fixed size,
+store the time as a delta to the previous record and an all-0xFF record marks free space.
+Writes are two-phase so a power cut at any point loses at most the record being written: a record's payload is
+programmed first and its commit trailer (CRC and commit byte) second, a sector header's magic goes in after the
+rest of it. At boot a record without a valid trailer is skipped as torn and appending continues after it.
+*/
+#define FLASHLOG_PARTITION      "datalog"
+#define FLASHLOG_SECTOR_SIZE    4096
+#define FLASHLOG_CKPT_SECTORS   2
+#define FLASHLOG_MAGIC          0x34474f4c //"LOG4", records gained the commit trailer
+#define FLASHLOG_DT_UNIT_MS     100
+#define FLASHLOG_DT_MAX         0xfffe     //0xffff is the erased marker
+#define FLASHLOG_CKPT_MAGIC     0x54504b43 //"CKPT"
+#define FLASHLOG_COMMITTED      0x00
+
+struct flashlog_sector_hdr{
+    uint32_t magic;
+    uint32_t seq;
+    int64_t base_ms;     //wall-clock ms of the first record
+};
+
+struct flashlog_record{
+    uint16_t dt;         //FLASHLOG_DT_UNIT_MS since the previous record (0 for the first one)
+    int16_t temperature; //tenths
+    uint16_t humidity;   //tenths
+    struct flashlog_commit commit;
+} __attribute__((packed));
+
+struct flashlog_ckpt_hdr{
+    uint32_t magic;
+    uint32_t gen;
+    uint32_t len;
+    uint32_t crc;
+};
+_Static_assert(FLASHLOG_CKPT_MAX == FLASHLOG_SECTOR_SIZE - sizeof(struct flashlog_ckpt_hdr), "FLASHLOG_CKPT_MAX is out of date");
+
+#define FLASHLOG_RECORDS_PER_SECTOR ((FLASHLOG_SECTOR_SIZE - sizeof(struct flashlog_sector_hdr)) / sizeof(struct flashlog_record))
+
+#define ROLLUP_RECORDS_PER_SECTOR ((FLASHLOG_SECTOR_SIZE - sizeof(struct flashlog_sector_hdr)) / sizeof(struct rollup_record))
+//the whole retention, plus the head sector being filled and the one being compacted away
+#define ROLLUP_TIER_SECTORS(window_s, days) \
+    (((days) * 86400 / (window_s) + ROLLUP_RECORDS_PER_SECTOR - 1) / ROLLUP_RECORDS_PER_SECTOR + 2)
+#if CONFIG_FLASHLOG_COMPACT
+#define ROLLUP_T1_SECTORS ROLLUP_TIER_SECTORS(CONFIG_ROLLUP_T1_WINDOW_S, CONFIG_ROLLUP_T1_RETENTION_DAYS)
+#define ROLLUP_T2_SECTORS ROLLUP_TIER_SECTORS(CONFIG_ROLLUP_T2_WINDOW_S, CONFIG_ROLLUP_T2_RETENTION_DAYS)
+#else
+#define ROLLUP_T1_SECTORS 0
+#define ROLLUP_T2_SECTORS 0
+#endif
+//the load generator's bench area sits between the raw log and the tiers: a raw ring and, with compaction, two small tiers
+#if CONFIG_LOADGEN_ENABLE
+#define FLASHLOG_BENCH_SECTORS CONFIG_LOADGEN_FLASH_SECTORS
+#define FLASHLOG_BENCH_MAGIC   0x48434e42 //"BNCH", never taken for a log sector should the area go back to the log
+#else
+#define FLASHLOG_BENCH_SECTORS 0
+#endif
+
+/*A ring of record sectors: the log itself, or the load generator's bench area*/
+struct flashlog_ring{
+    uint32_t magic;       //sector header magic
+    uint32_t base;        //first sector, counted from the start of the partition
+    uint32_t sectors;     //sectors available for records
+    uint32_t head;        //sector index (relative to base) being appended to
+    uint32_t seq;         //sequence number of the head sector
+    uint32_t offset;      //next free record slot in the head sector
+    int64_t last_ms;      //wall-clock ms of the last record, deltas are taken against it
+    uint32_t first_seq;   //sequence number of the oldest sector still in the ring
+};
+
+static const esp_partition_t *s_log_part;
+static struct flashlog_ring s_log = { .magic = FLASHLOG_MAGIC, .base = FLASHLOG_CKPT_SECTORS };
+static uint32_t s_ckpt_gen;
+//taken by the appender and by readers of the record area, so a download never reads a sector mid-erase
+static SemaphoreHandle_t s_log_lock;
+static StaticSemaphore_t s_log_lock_buf;
+
+static uint32_t s_log_torn;       //records found torn at boot
+static uint32_t s_log_recovery_us;
+
+static size_t flashlog_sector_addr(const struct flashlog_ring *l, uint32_t sector)
+{
+    return (l->base + sector) * FLASHLOG_SECTOR_SIZE;
+}
+
+/*Ring position of a sector still held, by sequence number*/
+static uint32_t flashlog_seq_sector(const struct flashlog_ring *l, uint32_t seq)
+{
+    return (l->head + l->sectors - (l->seq - seq)) % l->sectors;
+}
+
+//only the log itself has cut points, the bench area is scratch
+#define FLASHLOG_CUT_OF(l, at) ((l) == &s_log ? (at) : FLASHLOG_CUT_NONE)
+
+#if CONFIG_FLASHLOG_FAULT_INJECT
+/*
+Power-cut injection: the armed write boundary restarts the chip right after it, so the next boot recovers from
+exactly that state. What was durable at the cut is kept in RTC memory and compared with what the boot recovered.
+A sweep arms every boundary in turn, one per boot. Erase and header cuts force the next append into a new sector.
+The rollup tiers have their own boundaries: while one is armed the compactor runs as soon as there is a raw sector
+to fold, and the tier it writes also has its recovered newest record checked.
+*/
+static const char *const s_flashlog_cut_names[FLASHLOG_CUTS] = {
+    [FLASHLOG_CUT_NONE] = "none", [FLASHLOG_CUT_ERASE] = "erase", [FLASHLOG_CUT_HEADER] = "header", [FLASHLOG_CUT_RECORD] = "record",
+#if CONFIG_FLASHLOG_COMPACT
+    [FLASHLOG_CUT_ROLLUP_ERASE] = "rollup-erase", [FLASHLOG_CUT_ROLLUP_HEADER] = "rollup-header", [FLASHLOG_CUT_ROLLUP_RECORD] = "rollup-record",
+#endif
+};
+#define FLASHLOG_CUT_MAGIC 0x54554343 //"CCUT"
+
+struct flashlog_cut_state{
+    uint32_t magic;
+    enum flashlog_cut cut;
+    uint32_t seq;         //head sector holding the last committed record at the cut
+    int64_t last_ms;      //and that record's time
+    enum flashlog_cut sweep_next; //FLASHLOG_CUT_NONE when not sweeping
+    uint32_t sweep_failures;
+    //rollup cuts: the tier written and its newest committed record at the cut
+    uint32_t tier;
+    uint32_t tier_seq;
+    bool tier_has_last;
+    uint32_t tier_last_src;
+    uint32_t tier_last_start;
+};
+
+static enum flashlog_cut s_log_cut_armed;
+static RTC_NOINIT_ATTR struct flashlog_cut_state s_log_cut_rtc;
+static struct flashlog_cut_report s_log_cut_report;
+#define FLASHLOG_CUT_FORCE_OPEN (s_log_cut_armed == FLASHLOG_CUT_ERASE || s_log_cut_armed == FLASHLOG_CUT_HEADER)
+#if CONFIG_FLASHLOG_COMPACT
+#define ROLLUP_CUT_ARMED      (s_log_cut_armed >= FLASHLOG_CUT_ROLLUP_ERASE)
+#define ROLLUP_CUT_FORCE_OPEN (s_log_cut_armed == FLASHLOG_CUT_ROLLUP_ERASE || s_log_cut_armed == FLASHLOG_CUT_ROLLUP_HEADER)
+static bool rollup_cut_check(void);
+#endif
+
+static void flashlog_cut_point(enum flashlog_cut at)
+{
+    if(at == FLASHLOG_CUT_NONE || s_log_cut_armed != at)
+        return;
+    //the record or sector being written is not durable yet, the previous head still is
+    s_log_cut_rtc.magic = FLASHLOG_CUT_MAGIC;
+    s_log_cut_rtc.cut = at;
+    s_log_cut_rtc.seq = s_log.seq;
+    s_log_cut_rtc.last_ms = s_log.last_ms;
+    ESP_LOGW(TAG, "power cut injected after the %s write", s_flashlog_cut_names[at]);
+    esp_restart();
+}
+
+/*Arm one boundary, or with FLASHLOG_CUTS all of them one after the other*/
+void flashlog_cut_arm(enum flashlog_cut at)
+{
+    bool sweep = at == FLASHLOG_CUTS;
+    s_log_cut_rtc.magic = 0;
+    s_log_cut_rtc.sweep_next = sweep ? FLASHLOG_CUT_ERASE + 1 : FLASHLOG_CUT_NONE;
+    s_log_cut_rtc.sweep_failures = 0;
+    s_log_cut_armed = sweep ? FLASHLOG_CUT_ERASE : at;
+}
+
+const char *flashlog_cut_name(enum flashlog_cut at)
+{
+    return s_flashlog_cut_names[at];
+}
+
+/*What the last boot recovered from an injected cut, cut is FLASHLOG_CUT_NONE if there was none*/
+void flashlog_cut_last(struct flashlog_cut_report *out)
+{
+    *out = s_log_cut_report;
+}
+
+/*Compare the recovered head with the state saved at the cut, after flashlog_init*/
+static void flashlog_cut_check(void)
+{
+    if(s_log_cut_rtc.magic != FLASHLOG_CUT_MAGIC)
+        return;
+    s_log_cut_rtc.magic = 0;
+    s_log_cut_report = (struct flashlog_cut_report){ .cut = s_log_cut_rtc.cut, .torn = s_log_torn, .recovery_us = s_log_recovery_us,
+                                                     .ok = s_log.seq == s_log_cut_rtc.seq && s_log.last_ms == s_log_cut_rtc.last_ms };
+#if CONFIG_FLASHLOG_COMPACT
+    if(s_log_cut_report.cut >= FLASHLOG_CUT_ROLLUP_ERASE)
+        s_log_cut_report.ok = rollup_cut_check() && s_log_cut_report.ok;
+#endif
+    if(s_log_cut_report.ok)
+        ESP_LOGI(TAG, "recovered from a cut after the %s write, %u torn records", s_flashlog_cut_names[s_log_cut_report.cut], s_log_torn);
+    else
+        ESP_LOGE(TAG, "cut after the %s write: recovered seq %u at %lld ms, expected seq %u at %lld ms", s_flashlog_cut_names[s_log_cut_report.cut],
+                 s_log.seq, s_log.last_ms, s_log_cut_rtc.seq, s_log_cut_rtc.last_ms);
+    if(s_log_cut_rtc.sweep_next == FLASHLOG_CUT_NONE)
+        return;
+    s_log_cut_rtc.sweep_failures += !s_log_cut_report.ok;
+    if(s_log_cut_rtc.sweep_next < FLASHLOG_CUTS)
+    {
+        s_log_cut_armed = s_log_cut_rtc.sweep_next++;
+        return;
+    }
+    ESP_LOGI(TAG, "power cut sweep done, %u of %d boundaries failed", s_log_cut_rtc.sweep_failures, FLASHLOG_CUTS - 1);
+    s_log_cut_rtc.sweep_next = FLASHLOG_CUT_NONE;
+}
+#else
+#define flashlog_cut_point(at)
+#define FLASHLOG_CUT_FORCE_OPEN false
+#define ROLLUP_CUT_ARMED        false
+#define ROLLUP_CUT_FORCE_OPEN   false
+#endif
+
+/*State of a record slot of len bytes that ends in a struct flashlog_commit*/
+enum flashlog_slot flashlog_slot_state(const void *rec, size_t len)
+{
+    const uint8_t *b = rec;
+    const struct flashlog_commit *c = (const struct flashlog_commit *)(b + len - sizeof(*c));
+    if(c->state == FLASHLOG_COMMITTED && c->crc == esp_crc8_le(0, b, len - sizeof(*c)))
+        return FLASHLOG_SLOT_COMMITTED;
+    for(size_t i = 0; i < len; i++)
+        if(b[i] != 0xff)
+            return FLASHLOG_SLOT_TORN;
+    return FLASHLOG_SLOT_FREE;
+}
+
+/*Two-phase record write: the payload, then its commit trailer, which is filled in in rec as well. cut names the boundary*/
+static esp_err_t flashlog_write_committed(size_t addr, void *rec, size_t len, enum flashlog_cut cut)
+{
+    size_t payload = len - sizeof(struct flashlog_commit);
+    struct flashlog_commit *c = (struct flashlog_commit *)((uint8_t *)rec + payload);
+    *c = (struct flashlog_commit){ .crc = esp_crc8_le(0, rec, payload), .state = FLASHLOG_COMMITTED };
+    esp_err_t err = esp_partition_write(s_log_part, addr, rec, payload);
+    flashlog_cut_point(cut);
+    if(err == ESP_OK)
+        err = esp_partition_write(s_log_part, addr + payload, c, sizeof(*c));
+    return err;
+}
+
+/*Sector header write, the magic that makes it valid goes last*/
+static esp_err_t flashlog_write_hdr(size_t addr, const struct flashlog_sector_hdr *hdr, enum flashlog_cut cut)
+{
+    esp_err_t err = esp_partition_write(s_log_part, addr + sizeof(hdr->magic), &hdr->seq, sizeof(*hdr) - sizeof(hdr->magic));
+    flashlog_cut_point(cut);
+    if(err == ESP_OK)
+        err = esp_partition_write(s_log_part, addr, &hdr->magic, sizeof(hdr->magic));
+    return err;
+}
+
+/*Erase the next sector in the ring and stamp it as the new head*/
+static esp_err_t flashlog_open_sector(struct flashlog_ring *l, uint32_t sector, uint32_t seq, int64_t base_ms)
+{
+    size_t addr = flashlog_sector_addr(l, sector);
+    //the sector being reused was the oldest one
+    if(seq - l->first_seq >= l->sectors)
+        l->first_seq = seq - l->sectors + 1;
+    esp_err_t err = esp_partition_erase_range(s_log_part, addr, FLASHLOG_SECTOR_SIZE);
+    flashlog_cut_point(FLASHLOG_CUT_OF(l, FLASHLOG_CUT_ERASE));
+    if(err != ESP_OK)
+        return err;
+    struct flashlog_sector_hdr hdr = { .magic = l->magic, .seq = seq, .base_ms = base_ms };
+    err = flashlog_write_hdr(addr, &hdr, FLASHLOG_CUT_OF(l, FLASHLOG_CUT_HEADER));
+    if(err != ESP_OK)
+        return err;
+    l->head = sector;
+    l->seq = seq;
+    l->offset = 0;
+    l->last_ms = base_ms;
+    return ESP_OK;
+}
+
+/*Find the newest sector and the first free record in it*/
+esp_err_t flashlog_init(void)
+{
+    s_log_lock = xSemaphoreCreateMutexStatic(&s_log_lock_buf);
+    s_log_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, 0x40, FLASHLOG_PARTITION);
+    if(s_log_part == NULL)
+    {
+        ESP_LOGE(TAG, "no %s partition, samples will not be persisted", FLASHLOG_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint32_t total = s_log_part->size / FLASHLOG_SECTOR_SIZE;
+    if(total < FLASHLOG_CKPT_SECTORS + ROLLUP_T1_SECTORS + ROLLUP_T2_SECTORS + FLASHLOG_BENCH_SECTORS + 8)
+    {
+        ESP_LOGE(TAG, "%s partition too small for the rollup retention, samples will not be persisted", FLASHLOG_PARTITION);
+        s_log_part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    s_log.sectors = total - FLASHLOG_CKPT_SECTORS - ROLLUP_T1_SECTORS - ROLLUP_T2_SECTORS - FLASHLOG_BENCH_SECTORS;
+
+    //one pass over the headers: a header only counts once its magic is in, so every valid one belongs to the ring
+    int64_t start = esp_timer_get_time();
+    bool found = false;
+    for(uint32_t i = 0; i < s_log.sectors; i++)
+    {
+        struct flashlog_sector_hdr hdr;
+        if(esp_partition_read(s_log_part, flashlog_sector_addr(&s_log, i), &hdr, sizeof(hdr)) != ESP_OK || hdr.magic != FLASHLOG_MAGIC)
+            continue;
+        if(!found || (int32_t)(hdr.seq - s_log.seq) > 0)
+        {
+            s_log.head = i;
+            s_log.seq = hdr.seq;
+            s_log.last_ms = hdr.base_ms;
+        }
+        if(!found || (int32_t)(hdr.seq - s_log.first_seq) < 0)
+            s_log.first_seq = hdr.seq;
+        found = true;
+    }
+    if(!found)
+    {
+        //nothing valid (first boot or old format), start over; the next append opens a fresh sector
+        s_log.head = s_log.sectors - 1;
+        s_log.offset = FLASHLOG_RECORDS_PER_SECTOR;
+        s_log.first_seq = s_log.seq + 1;
+        s_log_recovery_us = esp_timer_get_time() - start;
+        return ESP_OK;
+    }
+
+    //records are written in order, so the first blank slot is the append position; replay the committed deltas on the way
+    size_t base = flashlog_sector_addr(&s_log, s_log.head) + sizeof(struct flashlog_sector_hdr);
+    struct flashlog_record recs[32];
+    bool end = false;
+    for(s_log.offset = 0; s_log.offset < FLASHLOG_RECORDS_PER_SECTOR && !end; )
+    {
+        uint32_t n = MIN(sizeof(recs) / sizeof(recs[0]), FLASHLOG_RECORDS_PER_SECTOR - s_log.offset);
+        if(esp_partition_read(s_log_part, base + s_log.offset * sizeof(recs[0]), recs, n * sizeof(recs[0])) != ESP_OK)
+            break;
+        for(uint32_t i = 0; i < n && !end; i++)
+        {
+            enum flashlog_slot state = flashlog_slot_state(&recs[i], sizeof(recs[i]));
+            end = state == FLASHLOG_SLOT_FREE;
+            if(end)
+                break;
+            s_log.offset++;
+            if(state == FLASHLOG_SLOT_COMMITTED)
+                s_log.last_ms += recs[i].dt * FLASHLOG_DT_UNIT_MS;
+            else
+                s_log_torn++;
+        }
+    }
+    s_log_recovery_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "flash log head sector %u seq %u record %u, %u torn, recovered in %u us",
+             s_log.head, s_log.seq, s_log.offset, s_log_torn, s_log_recovery_us);
+    return ESP_OK;
+}
+
+static esp_err_t flashlog_ring_append(struct flashlog_ring *l, const struct data *sample)
+{
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    int64_t wall_ms = clock_wall_us(sample->mono_us) / 1000;
+    int64_t dt = (wall_ms - l->last_ms) / FLASHLOG_DT_UNIT_MS;
+    //a full sector, a clock step backwards or a gap too long for the delta all start a new sector with a fresh base
+    if(l->offset >= FLASHLOG_RECORDS_PER_SECTOR || dt < 0 || dt > FLASHLOG_DT_MAX || (l == &s_log && FLASHLOG_CUT_FORCE_OPEN))
+    {
+        err = flashlog_open_sector(l, (l->head + 1) % l->sectors, l->seq + 1, wall_ms);
+        dt = 0;
+    }
+    struct flashlog_record rec = { .dt = dt, .temperature = sample->temperature, .humidity = sample->humidity };
+    size_t addr = flashlog_sector_addr(l, l->head) + sizeof(struct flashlog_sector_hdr) + l->offset * sizeof(rec);
+    if(err == ESP_OK)
+    {
+        err = flashlog_write_committed(addr, &rec, sizeof(rec), FLASHLOG_CUT_OF(l, FLASHLOG_CUT_RECORD));
+        //a failed write may have programmed part of the slot, it stays behind as a torn record
+        l->offset++;
+    }
+    //advance by the rounded delta so rounding errors do not accumulate
+    if(err == ESP_OK)
+        l->last_ms += dt * FLASHLOG_DT_UNIT_MS;
+    xSemaphoreGive(s_log_lock);
+    return err;
+}
+
+esp_err_t flashlog_append(const struct data *sample)
+{
+    if(s_log_part == NULL)
+        return ESP_ERR_INVALID_STATE;
+    return flashlog_ring_append(&s_log, sample);
+}
+
+/*
+The record area read as one byte stream: sectors from the oldest to the head in ring order, headers and unused
+tails included, ending at the append position. A byte offset maps straight onto a sector and a position in it.
+Returns the stream length and the sequence number of its first sector, which identifies the stream; it changes
+when the oldest sector is reused and until then the stream only grows at the end.
+*/
+uint32_t flashlog_extent(uint32_t *first_seq)
+{
+    if(s_log_part == NULL)
+    {
+        *first_seq = 0;
+        return 0;
+    }
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    *first_seq = s_log.first_seq;
+    uint32_t len = 0;
+    if((int32_t)(s_log.seq - s_log.first_seq) >= 0)
+        len = (s_log.seq - s_log.first_seq) * FLASHLOG_SECTOR_SIZE + sizeof(struct flashlog_sector_hdr) +
+              s_log.offset * sizeof(struct flashlog_record);
+    xSemaphoreGive(s_log_lock);
+    return len;
+}
+
+/*
+Read up to len bytes at offset of the stream that started at first_seq, stopping at a sector boundary.
+Returns the bytes read, 0 at the end of the stream, or -1 once the sector holding offset has been reused.
+*/
+int flashlog_read(uint32_t first_seq, uint32_t offset, void *buf, uint32_t len)
+{
+    if(s_log_part == NULL)
+        return -1;
+    uint32_t seq = first_seq + offset / FLASHLOG_SECTOR_SIZE;
+    uint32_t pos = offset % FLASHLOG_SECTOR_SIZE;
+    int ret = -1;
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    if((int32_t)(seq - s_log.first_seq) >= 0 && (int32_t)(s_log.seq - seq) >= 0)
+    {
+        uint32_t end = seq == s_log.seq ? sizeof(struct flashlog_sector_hdr) + s_log.offset * sizeof(struct flashlog_record)
+                                        : FLASHLOG_SECTOR_SIZE;
+        len = pos < end ? MIN(len, end - pos) : 0;
+        uint32_t sector = flashlog_seq_sector(&s_log, seq);
+        if(len == 0 || esp_partition_read(s_log_part, flashlog_sector_addr(&s_log, sector) + pos, buf, len) == ESP_OK)
+            ret = len;
+    }
+    else if((int32_t)(seq - s_log.seq) > 0)
+        ret = 0;
+    xSemaphoreGive(s_log_lock);
+    return ret;
+}
+
+/*
+Flash stress for the console: erase, or program one 256-byte page of, the sector two ahead of the head. It holds no
+records while the ring has not wrapped onto it (compaction keeps it that way) and is erased again before it is
+opened, and its header never gets a valid magic. Returns ESP_ERR_INVALID_STATE when that sector holds data.
+*/
+esp_err_t flashlog_stress_op(bool erase, uint32_t page)
+{
+    if(s_log_part == NULL)
+        return ESP_ERR_INVALID_STATE;
+    static uint8_t pattern[256];
+    memset(pattern, 0x55, sizeof(pattern));
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    //the sector two ahead last held seq s_log.seq + 2 - s_log.sectors
+    if(s_log.sectors > 2 && (int32_t)(s_log.seq + 2 - s_log.sectors - s_log.first_seq) < 0)
+    {
+        size_t addr = flashlog_sector_addr(&s_log, (s_log.head + 2) % s_log.sectors);
+        if(erase)
+            err = esp_partition_erase_range(s_log_part, addr, FLASHLOG_SECTOR_SIZE);
+        else
+            err = esp_partition_write(s_log_part, addr + page % (FLASHLOG_SECTOR_SIZE / sizeof(pattern)) * sizeof(pattern),
+                                      pattern, sizeof(pattern));
+    }
+    xSemaphoreGive(s_log_lock);
+    return err;
+}
+
+/*Write a checkpoint blob into the older of the two checkpoint sectors*/
+esp_err_t flashlog_save_checkpoint(const void *blob, uint32_t len)
+{
+    if(s_log_part == NULL)
+        return ESP_ERR_INVALID_STATE;
+    if(len > FLASHLOG_CKPT_MAX)
+        return ESP_ERR_INVALID_SIZE;
+    uint32_t gen = s_ckpt_gen + 1;
+    size_t addr = (gen % FLASHLOG_CKPT_SECTORS) * FLASHLOG_SECTOR_SIZE;
+    struct flashlog_ckpt_hdr hdr = { .magic = FLASHLOG_CKPT_MAGIC, .gen = gen, .len = len, .crc = esp_crc32_le(0, blob, len) };
+    esp_err_t err = esp_partition_erase_range(s_log_part, addr, FLASHLOG_SECTOR_SIZE);
+    if(err == ESP_OK)
+        err = esp_partition_write(s_log_part, addr + sizeof(hdr), blob, len);
+    //header goes last so a torn write leaves the previous checkpoint as the newest valid one
+    if(err == ESP_OK)
+        err = esp_partition_write(s_log_part, addr, &hdr, sizeof(hdr));
+    if(err == ESP_OK)
+        s_ckpt_gen = gen;
+    return err;
+}
+
+/*Load the newest valid checkpoint of exactly len bytes*/
+esp_err_t flashlog_load_checkpoint(void *blob, uint32_t len)
+{
+    if(s_log_part == NULL)
+        return ESP_ERR_INVALID_STATE;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    for(uint32_t i = 0; i < FLASHLOG_CKPT_SECTORS; i++)
+    {
+        struct flashlog_ckpt_hdr hdr;
+        size_t addr = i * FLASHLOG_SECTOR_SIZE;
+        if(esp_partition_read(s_log_part, addr, &hdr, sizeof(hdr)) != ESP_OK || hdr.magic != FLASHLOG_CKPT_MAGIC || hdr.len != len)
+            continue;
+        if(ret == ESP_OK && (int32_t)(hdr.gen - s_ckpt_gen) <= 0)
+            continue;
+        if(esp_partition_read(s_log_part, addr + sizeof(hdr), blob, len) != ESP_OK || esp_crc32_le(0, blob, len) != hdr.crc)
+            continue;
+        s_ckpt_gen = hdr.gen;
+        ret = ESP_OK;
+    }
+    //a newer but corrupt copy may have been read last, re-read the winner
+    if(ret == ESP_OK)
+        esp_partition_read(s_log_part, (s_ckpt_gen % FLASHLOG_CKPT_SECTORS) * FLASHLOG_SECTOR_SIZE + sizeof(struct flashlog_ckpt_hdr), blob, len);
+    return ret;
+}
+
+bool flashlog_ready(void)
+{
+    return s_log_part != NULL;
+}
+
+void flashlog_get_status(struct flashlog_status *out)
+{
+    *out = (struct flashlog_status){ .sector = s_log.head, .seq = s_log.seq, .record = s_log.offset, .torn = s_log_torn,
+                                     .recovery_us = s_log_recovery_us };
+}
+/*Flash log section END*/
+
+
+/*Rollup section START*/
+#if CONFIG_FLASHLOG_COMPACT
+/*
+Raw sectors are not kept forever. When fewer than FLASHLOG_COMPACT_FREE_SECTORS raw sectors are free, the oldest
+one is folded into tier 1 rollups (ROLLUP_T1_WINDOW_S windows) and erased; tier 1 is folded into tier 2 the same
+way before it fills up, and tier 2 wraps onto its oldest sector. Tiers are sized for their configured retention.
+The compactor works in steps of one chunk of records or one erase, run half a sample interval after a sample is
+published, so it stays clear of both the sensor read and the scrape the sampler is aligned to.
+Every rollup names the sector it was made from. A sector compacted again after a power cut only adds the windows
+that are missing, and a window cut by a sector boundary is written once per sector.
+*/
+#define ROLLUP_MAGIC       0x32504c52 //"RLP2"
+#define ROLLUP_CHUNK_BYTES 1024
+
+struct rollup_ring{
+    uint32_t base;        //first sector of the tier, counted from the start of the partition
+    uint32_t sectors;
+    uint32_t window_s;
+    uint32_t head;        //sector being appended to, relative to base
+    uint32_t seq;         //its sequence number
+    uint32_t offset;      //next free record in it
+    uint32_t first_seq;   //oldest sector still held
+    bool has_last;        //newest record written
+    bool resume;          //set until the first new record after a restart, windows up to the newest one are skipped
+    uint32_t last_src;
+    uint32_t last_start;
+    uint32_t version;     //bumped whenever records are added or dropped, for cached /api/v1/rollups responses
+};
+
+struct rollup_job{
+    int tier;             //-1 idle, 0 raw into tier 1, 1 tier 1 into tier 2
+    uint32_t src_seq;
+    uint32_t next;        //next record of the source sector
+    bool reading;         //false once the sector has been read, the erase is left
+    int64_t t_ms;         //raw: time of the last record read
+    struct rollup_acc acc;
+};
+
+struct rollup_stats{
+    uint32_t jobs;
+    uint32_t steps;
+    uint32_t rollups;
+    uint32_t skipped;     //windows already written before a restart
+    uint32_t overruns;    //source sector reused before it was compacted
+    uint32_t errors;
+    uint32_t max_step_us;
+};
+
+/*A raw ring, the tiers compacted from it and the compaction in progress: the log itself, or the bench area*/
+struct rollup_store{
+    struct flashlog_ring *raw;
+    struct rollup_ring tier[ROLLUP_TIERS];
+    struct rollup_job job;
+    struct rollup_stats stats;
+    uint8_t chunk[ROLLUP_CHUNK_BYTES];
+};
+
+static struct rollup_store s_store = { .raw = &s_log, .job = { .tier = -1 } };
+static StackType_t s_compactor_stack[3072];
+static StaticTask_t s_compactor_tcb;
+static TaskHandle_t s_compactor_task;
+
+static size_t rollup_sector_addr(const struct rollup_ring *r, uint32_t sector)
+{
+    return (r->base + sector) * FLASHLOG_SECTOR_SIZE;
+}
+
+static uint32_t rollup_seq_sector(const struct rollup_ring *r, uint32_t seq)
+{
+    return (r->head + r->sectors - (r->seq - seq)) % r->sectors;
+}
+
+static uint32_t rollup_free_sectors(const struct rollup_ring *r)
+{
+    uint32_t used = (int32_t)(r->seq - r->first_seq) >= 0 ? r->seq - r->first_seq + 1 : 0;
+    return r->sectors - used;
+}
+
+/*Same scan as flashlog_init: newest sector, oldest sector, first free record and the newest record*/
+static void rollup_ring_init(struct rollup_ring *r, uint32_t base, uint32_t sectors, uint32_t window_s)
+{
+    *r = (struct rollup_ring){ .base = base, .sectors = sectors, .window_s = window_s,
+                               .head = sectors - 1, .offset = ROLLUP_RECORDS_PER_SECTOR, .first_seq = 1 };
+    bool found = false;
+    for(uint32_t i = 0; i < sectors; i++)
+    {
+        struct flashlog_sector_hdr hdr;
+        if(esp_partition_read(s_log_part, rollup_sector_addr(r, i), &hdr, sizeof(hdr)) != ESP_OK ||
+           hdr.magic != ROLLUP_MAGIC || hdr.base_ms != window_s)
+            continue;
+        if(!found || (int32_t)(hdr.seq - r->seq) > 0)
+        {
+            found = true;
+            r->head = i;
+            r->seq = hdr.seq;
+        }
+    }
+    if(!found)
+        return;
+    r->first_seq = r->seq;
+    for(uint32_t i = 0; i < sectors; i++)
+    {
+        struct flashlog_sector_hdr hdr;
+        if(esp_partition_read(s_log_part, rollup_sector_addr(r, i), &hdr, sizeof(hdr)) == ESP_OK && hdr.magic == ROLLUP_MAGIC &&
+           hdr.base_ms == window_s && r->seq - hdr.seq < sectors && (int32_t)(hdr.seq - r->first_seq) < 0)
+            r->first_seq = hdr.seq;
+    }
+
+    //the newest record is the last committed one in the head sector, or in the sector before if the head has none
+    size_t base_addr = rollup_sector_addr(r, r->head) + sizeof(struct flashlog_sector_hdr);
+    struct rollup_record rec;
+    for(r->offset = 0; r->offset < ROLLUP_RECORDS_PER_SECTOR; r->offset++)
+    {
+        esp_partition_read(s_log_part, base_addr + r->offset * sizeof(rec), &rec, sizeof(rec));
+        enum flashlog_slot state = flashlog_slot_state(&rec, sizeof(rec));
+        if(state == FLASHLOG_SLOT_FREE)
+            break;
+        if(state == FLASHLOG_SLOT_TORN)
+            continue;
+        r->has_last = true;
+        r->last_src = rec.src_seq;
+        r->last_start = rec.start_s;
+    }
+    if(!r->has_last && r->first_seq != r->seq)
+    {
+        base_addr = rollup_sector_addr(r, rollup_seq_sector(r, r->seq - 1)) + sizeof(struct flashlog_sector_hdr);
+        for(uint32_t i = ROLLUP_RECORDS_PER_SECTOR; i-- > 0 && !r->has_last; )
+        {
+            esp_partition_read(s_log_part, base_addr + i * sizeof(rec), &rec, sizeof(rec));
+            if(flashlog_slot_state(&rec, sizeof(rec)) != FLASHLOG_SLOT_COMMITTED)
+                continue;
+            r->has_last = true;
+            r->last_src = rec.src_seq;
+            r->last_start = rec.start_s;
+        }
+    }
+    r->resume = r->has_last;
+}
+
+#if CONFIG_FLASHLOG_FAULT_INJECT
+/*What a cut in the middle of the next write to r must leave durable*/
+static void rollup_cut_note(const struct rollup_ring *r)
+{
+    s_log_cut_rtc.tier = r - s_store.tier;
+    s_log_cut_rtc.tier_seq = r->seq;
+    s_log_cut_rtc.tier_has_last = r->has_last;
+    s_log_cut_rtc.tier_last_src = r->last_src;
+    s_log_cut_rtc.tier_last_start = r->last_start;
+}
+
+/*Compare the tier the cut hit with what was durable at the cut, after rollup_init*/
+static bool rollup_cut_check(void)
+{
+    const struct rollup_ring *r = &s_store.tier[MIN(s_log_cut_rtc.tier, ROLLUP_TIERS - 1)];
+    bool ok = r->seq == s_log_cut_rtc.tier_seq && r->has_last == s_log_cut_rtc.tier_has_last &&
+              (!r->has_last || (r->last_src == s_log_cut_rtc.tier_last_src && r->last_start == s_log_cut_rtc.tier_last_start));
+    if(!ok)
+        ESP_LOGE(TAG, "cut in tier %u: recovered seq %u, newest from %u at %u s, expected seq %u, newest from %u at %u s",
+                 s_log_cut_rtc.tier + 1, r->seq, r->last_src, r->last_start, s_log_cut_rtc.tier_seq, s_log_cut_rtc.tier_last_src,
+                 s_log_cut_rtc.tier_last_start);
+    return ok;
+}
+#else
+#define rollup_cut_note(r)
+#endif
+
+/*Append a rollup to a tier of st, opening (and if the tier is full, reusing) the next sector; called with s_log_lock held*/
+static esp_err_t rollup_append(struct rollup_store *st, struct rollup_ring *r, struct rollup_record *rec)
+{
+    bool live = st == &s_store;
+    if(r->resume && ((int32_t)(rec->src_seq - r->last_src) < 0 || (rec->src_seq == r->last_src && rec->start_s <= r->last_start)))
+    {
+        st->stats.skipped++;
+        return ESP_OK;
+    }
+    if(live)
+        rollup_cut_note(r);
+    if(r->offset >= ROLLUP_RECORDS_PER_SECTOR || (live && ROLLUP_CUT_FORCE_OPEN))
+    {
+        uint32_t seq = r->seq + 1, sector = (r->head + 1) % r->sectors;
+        if(seq - r->first_seq >= r->sectors)
+            r->first_seq = seq - r->sectors + 1;
+        struct flashlog_sector_hdr hdr = { .magic = ROLLUP_MAGIC, .seq = seq, .base_ms = r->window_s };
+        esp_err_t err = esp_partition_erase_range(s_log_part, rollup_sector_addr(r, sector), FLASHLOG_SECTOR_SIZE);
+        flashlog_cut_point(live ? FLASHLOG_CUT_ROLLUP_ERASE : FLASHLOG_CUT_NONE);
+        if(err == ESP_OK)
+            err = flashlog_write_hdr(rollup_sector_addr(r, sector), &hdr, live ? FLASHLOG_CUT_ROLLUP_HEADER : FLASHLOG_CUT_NONE);
+        if(err != ESP_OK)
+            return err;
+        r->head = sector;
+        r->seq = seq;
+        r->offset = 0;
+    }
+    esp_err_t err = flashlog_write_committed(rollup_sector_addr(r, r->head) + sizeof(struct flashlog_sector_hdr) +
+                                             r->offset * sizeof(*rec), rec, sizeof(*rec),
+                                             live ? FLASHLOG_CUT_ROLLUP_RECORD : FLASHLOG_CUT_NONE);
+    r->offset++;
+    r->version++;
+    if(err == ESP_OK)
+    {
+        r->has_last = true;
+        r->resume = false;
+        r->last_src = rec->src_seq;
+        r->last_start = rec->start_s;
+        st->stats.rollups++;
+    }
+    return err;
+}
+
+/*Write out the window being accumulated into the job's destination tier*/
+static void rollup_flush(struct rollup_store *st)
+{
+    struct rollup_job *j = &st->job;
+    struct rollup_acc *a = &j->acc;
+    if(a->count == 0)
+        return;
+    struct rollup_record rec = {
+        .start_s = a->start_s, .src_seq = j->src_seq, .count = MIN(a->count, UINT16_MAX),
+        .t_min = a->t_min, .t_avg = a->t_sum / (int32_t)a->count, .t_max = a->t_max,
+        .h_min = a->h_min, .h_avg = a->h_sum / a->count, .h_max = a->h_max,
+    };
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    if(rollup_append(st, &st->tier[j->tier], &rec) != ESP_OK)
+        st->stats.errors++;
+    xSemaphoreGive(s_log_lock);
+    a->count = 0;
+}
+
+/*Fold count samples with the given totals and extremes, starting at time t_s, into the job's current window*/
+static void rollup_fold(struct rollup_store *st, uint32_t t_s, uint32_t count, int32_t t_sum, uint32_t h_sum,
+                        int16_t t_min, int16_t t_max, uint16_t h_min, uint16_t h_max)
+{
+    struct rollup_job *j = &st->job;
+    uint32_t window = st->tier[j->tier].window_s;
+    uint32_t start = t_s - t_s % window;
+    struct rollup_acc *a = &j->acc;
+    if(a->count && a->start_s != start)
+        rollup_flush(st);
+    if(a->count == 0)
+        *a = (struct rollup_acc){ .start_s = start, .t_min = t_min, .t_max = t_max, .h_min = h_min, .h_max = h_max };
+    a->count += count;
+    a->t_sum += t_sum;
+    a->h_sum += h_sum;
+    a->t_min = MIN(a->t_min, t_min);
+    a->t_max = MAX(a->t_max, t_max);
+    a->h_min = MIN(a->h_min, h_min);
+    a->h_max = MAX(a->h_max, h_max);
+}
+
+/*Tier 1 before raw, so tier 1 always has room for what the raw sector turns into. An armed rollup cut folds early*/
+static bool rollup_pick_job(struct rollup_store *st)
+{
+    struct rollup_job *j = &st->job;
+    const struct flashlog_ring *raw = st->raw;
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    const struct rollup_ring *t1 = &st->tier[0];
+    uint32_t raw_used = (int32_t)(raw->seq - raw->first_seq) >= 0 ? raw->seq - raw->first_seq + 1 : 0;
+    *j = (struct rollup_job){ .tier = -1, .reading = true };
+    if(rollup_free_sectors(t1) < 2 && t1->first_seq != t1->seq)
+    {
+        j->tier = 1;
+        j->src_seq = t1->first_seq;
+    }
+    else if((raw->sectors - raw_used < CONFIG_FLASHLOG_COMPACT_FREE_SECTORS || (st == &s_store && ROLLUP_CUT_ARMED)) && raw_used >= 2)
+    {
+        j->tier = 0;
+        j->src_seq = raw->first_seq;
+    }
+    xSemaphoreGive(s_log_lock);
+    return j->tier >= 0;
+}
+
+/*Read the next chunk of the source sector and fold it; false once the sector is done*/
+static bool rollup_read_chunk(struct rollup_store *st)
+{
+    struct rollup_job *j = &st->job;
+    uint32_t n = 0;
+    bool gone;
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    if(j->tier == 0)
+    {
+        gone = (int32_t)(j->src_seq - st->raw->first_seq) < 0;
+        size_t addr = flashlog_sector_addr(st->raw, flashlog_seq_sector(st->raw, j->src_seq));
+        if(!gone && j->next == 0)
+        {
+            struct flashlog_sector_hdr hdr;
+            esp_partition_read(s_log_part, addr, &hdr, sizeof(hdr));
+            j->t_ms = hdr.base_ms;
+        }
+        n = MIN(ROLLUP_CHUNK_BYTES / sizeof(struct flashlog_record), FLASHLOG_RECORDS_PER_SECTOR - j->next);
+        if(!gone)
+            esp_partition_read(s_log_part, addr + sizeof(struct flashlog_sector_hdr) + j->next * sizeof(struct flashlog_record),
+                               st->chunk, n * sizeof(struct flashlog_record));
+    }
+    else
+    {
+        const struct rollup_ring *t1 = &st->tier[0];
+        gone = (int32_t)(j->src_seq - t1->first_seq) < 0;
+        n = MIN(ROLLUP_CHUNK_BYTES / sizeof(struct rollup_record), ROLLUP_RECORDS_PER_SECTOR - j->next);
+        if(!gone)
+            esp_partition_read(s_log_part, rollup_sector_addr(t1, rollup_seq_sector(t1, j->src_seq)) + sizeof(struct flashlog_sector_hdr) +
+                               j->next * sizeof(struct rollup_record), st->chunk, n * sizeof(struct rollup_record));
+    }
+    xSemaphoreGive(s_log_lock);
+    if(gone)
+    {
+        st->stats.overruns++;
+        j->tier = -1;
+        return false;
+    }
+
+    bool end = false;
+    for(uint32_t i = 0; i < n && !end; i++)
+    {
+        if(j->tier == 0)
+        {
+            const struct flashlog_record *rec = (const struct flashlog_record *)st->chunk + i;
+            enum flashlog_slot state = flashlog_slot_state(rec, sizeof(*rec));
+            end = state == FLASHLOG_SLOT_FREE;
+            if(state != FLASHLOG_SLOT_COMMITTED)
+                continue;
+            j->t_ms += rec->dt * FLASHLOG_DT_UNIT_MS;
+            rollup_fold(st, j->t_ms / 1000, 1, rec->temperature, rec->humidity, rec->temperature, rec->temperature,
+                        rec->humidity, rec->humidity);
+        }
+        else
+        {
+            const struct rollup_record *rec = (const struct rollup_record *)st->chunk + i;
+            enum flashlog_slot state = flashlog_slot_state(rec, sizeof(*rec));
+            end = state == FLASHLOG_SLOT_FREE;
+            if(state != FLASHLOG_SLOT_COMMITTED)
+                continue;
+            rollup_fold(st, rec->start_s, rec->count, rec->t_avg * rec->count, rec->h_avg * rec->count,
+                        rec->t_min, rec->t_max, rec->h_min, rec->h_max);
+        }
+    }
+    j->next += n;
+    if(end || j->next >= (j->tier == 0 ? FLASHLOG_RECORDS_PER_SECTOR : ROLLUP_RECORDS_PER_SECTOR))
+    {
+        rollup_flush(st);
+        return false;
+    }
+    return true;
+}
+
+/*Erase the compacted source sector, unless the ring has already moved past it*/
+static void rollup_erase_source(struct rollup_store *st)
+{
+    const struct rollup_job *j = &st->job;
+    struct flashlog_ring *raw = st->raw;
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if(j->tier == 0 && j->src_seq == raw->first_seq && j->src_seq != raw->seq)
+    {
+        err = esp_partition_erase_range(s_log_part, flashlog_sector_addr(raw, flashlog_seq_sector(raw, j->src_seq)), FLASHLOG_SECTOR_SIZE);
+        raw->first_seq++;
+    }
+    else if(j->tier == 1 && j->src_seq == st->tier[0].first_seq && j->src_seq != st->tier[0].seq)
+    {
+        struct rollup_ring *t1 = &st->tier[0];
+        err = esp_partition_erase_range(s_log_part, rollup_sector_addr(t1, rollup_seq_sector(t1, j->src_seq)), FLASHLOG_SECTOR_SIZE);
+        t1->first_seq++;
+        t1->version++;
+    }
+    xSemaphoreGive(s_log_lock);
+    if(err != ESP_OK)
+        st->stats.errors++;
+}
+
+/*One slice of work: pick a job, or read one chunk of its sector, or erase it. Returns false when idle*/
+static bool rollup_step(struct rollup_store *st)
+{
+    struct rollup_job *j = &st->job;
+    if(j->tier < 0)
+        return rollup_pick_job(st);
+    if(j->reading)
+    {
+        j->reading = rollup_read_chunk(st);
+        return true;
+    }
+    rollup_erase_source(st);
+    j->tier = -1;
+    st->stats.jobs++;
+    return true;
+}
+
+/*Whether the next step erases: the source sector, or the destination's next sector on its first append*/
+static bool rollup_step_erases(const struct rollup_store *st)
+{
+    const struct rollup_job *j = &st->job;
+    return j->tier >= 0 && (!j->reading || st->tier[j->tier].offset >= ROLLUP_RECORDS_PER_SECTOR);
+}
+
+static void compactor_task(void *arg)
+{
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        struct app_config cfg;
+        config_get(&cfg);
+        vTaskDelay(pdMS_TO_TICKS(cfg.sample_interval_ms / 2));
+        if(rollup_step_erases(&s_store))
+            capture_wait_clear();
+        int64_t start = esp_timer_get_time();
+        if(rollup_step(&s_store))
+        {
+            s_store.stats.steps++;
+            s_store.stats.max_step_us = MAX(s_store.stats.max_step_us, (uint32_t)(esp_timer_get_time() - start));
+        }
+    }
+}
+
+/*Copy up to max records of a tier from the cursor on, oldest first; a cursor whose sector was reused skips ahead*/
+uint32_t rollup_copy(int tier, uint32_t *seq, uint32_t *index, struct rollup_record *out, uint32_t max)
+{
+    const struct rollup_ring *r = &s_store.tier[tier];
+    uint32_t count = 0;
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    if((int32_t)(*seq - r->first_seq) < 0)
+    {
+        *seq = r->first_seq;
+        *index = 0;
+    }
+    while(count < max && (int32_t)(r->seq - *seq) >= 0)
+    {
+        uint32_t end = *seq == r->seq ? r->offset : ROLLUP_RECORDS_PER_SECTOR;
+        if(*index >= end)
+        {
+            if(*seq == r->seq)
+                break;
+            (*seq)++;
+            *index = 0;
+            continue;
+        }
+        uint32_t n = MIN(max - count, end - *index);
+        if(esp_partition_read(s_log_part, rollup_sector_addr(r, rollup_seq_sector(r, *seq)) + sizeof(struct flashlog_sector_hdr) +
+                              *index * sizeof(*out), out + count, n * sizeof(*out)) != ESP_OK)
+            break;
+        count += n;
+        *index += n;
+    }
+    xSemaphoreGive(s_log_lock);
+    return count;
+}
+
+uint32_t rollup_window_s(int tier)
+{
+    return s_store.tier[tier].window_s;
+}
+
+uint32_t rollup_version(int tier)
+{
+    return s_store.tier[tier].version;
+}
+
+/*Find both tiers after flashlog_init, drop what was already compacted before a restart and start the compactor*/
+void rollup_init(void)
+{
+    uint32_t t1_base = FLASHLOG_CKPT_SECTORS + s_log.sectors + FLASHLOG_BENCH_SECTORS;
+    rollup_ring_init(&s_store.tier[1], t1_base + ROLLUP_T1_SECTORS, ROLLUP_T2_SECTORS, CONFIG_ROLLUP_T2_WINDOW_S);
+    rollup_ring_init(&s_store.tier[0], t1_base, ROLLUP_T1_SECTORS, CONFIG_ROLLUP_T1_WINDOW_S);
+    //a source sector that is still there after its last rollup was written is compacted again, only its missing windows get added
+    struct rollup_ring *t1 = &s_store.tier[0], *t2 = &s_store.tier[1];
+    if(t2->has_last && (int32_t)(t2->last_src - t1->first_seq) > 0 && (int32_t)(t1->seq - t2->last_src) >= 0)
+        t1->first_seq = t2->last_src;
+    if(t1->has_last && (int32_t)(t1->last_src - s_log.first_seq) > 0 && (int32_t)(s_log.seq - t1->last_src) >= 0)
+        s_log.first_seq = t1->last_src;
+    ESP_LOGI(TAG, "rollups: raw %u sectors, tier 1 %u (seq %u..%u), tier 2 %u (seq %u..%u)", s_log.sectors,
+             t1->sectors, t1->first_seq, t1->seq, t2->sectors, t2->first_seq, t2->seq);
+    s_compactor_task = xTaskCreateStatic(compactor_task, "compactor", sizeof(s_compactor_stack), NULL, 2,
+                                         s_compactor_stack, &s_compactor_tcb);
+}
+
+int debug_format_compactor(char *out, size_t len)
+{
+    static const char *const names[ROLLUP_TIERS] = { "tier1", "tier2" };
+    xSemaphoreTake(s_log_lock, portMAX_DELAY);
+    uint32_t raw_used = (int32_t)(s_log.seq - s_log.first_seq) >= 0 ? s_log.seq - s_log.first_seq + 1 : 0;
+    struct rollup_ring rings[ROLLUP_TIERS];
+    memcpy(rings, s_store.tier, sizeof(rings));
+    struct rollup_stats st = s_store.stats;
+    int tier = s_store.job.tier;
+    xSemaphoreGive(s_log_lock);
+    int n = 0;
+    APPEND(out, len, n, "{\"raw\":{\"sectors\":%u,\"used\":%u,\"free\":%u}", s_log.sectors, raw_used, s_log.sectors - raw_used);
+    for(int i = 0; i < ROLLUP_TIERS; i++)
+        APPEND(out, len, n, ",\"%s\":{\"window_s\":%u,\"sectors\":%u,\"free\":%u,\"first_seq\":%u,\"seq\":%u}", names[i],
+               rings[i].window_s, rings[i].sectors, rollup_free_sectors(&rings[i]), rings[i].first_seq, rings[i].seq);
+    APPEND(out, len, n, ",\"job\":%d,\"jobs\":%u,\"steps\":%u,\"rollups\":%u,\"skipped\":%u,\"overruns\":%u,\"errors\":%u,\"max_step_us\":%u,"
+           "\"erase_deferrals\":%u}", tier, st.jobs, st.steps, st.rollups, st.skipped, st.overruns, st.errors, st.max_step_us,
+           capture_deferrals());
+    return n;
+}
+#endif
+
+/*Called after every sample, wakes the compactor for its next step*/
+void rollup_notify(void)
+{
+#if CONFIG_FLASHLOG_COMPACT
+    if(s_compactor_task)
+        xTaskNotifyGive(s_compactor_task);
+#endif
+}
+/*Rollup section END*/
+
+/*Bench section START*/
+#if CONFIG_LOADGEN_ENABLE
+/*
+The load generator's flash sink. Its samples take the same record writes and sector opens as the log and, with
+FLASHLOG_COMPACT, one compaction step each as the compactor does per sample, but into the bench area, so the log
+and its tiers never hold a synthetic sample. Erases wait for the sensor read as the compactor's do. The bench
+starts empty on every open and nothing reads it back; one bench is open at a time.
+*/
+#if CONFIG_FLASHLOG_COMPACT
+#define FLASHLOG_BENCH_TIER_SECTORS 3
+#else
+#define FLASHLOG_BENCH_TIER_SECTORS 0
+#endif
+_Static_assert(FLASHLOG_BENCH_SECTORS >= 2 * FLASHLOG_BENCH_TIER_SECTORS + 2, "LOADGEN_FLASH_SECTORS too small for the bench tiers");
+
+struct flashlog_bench{
+    struct flashlog_ring raw;
+#if CONFIG_FLASHLOG_COMPACT
+    struct rollup_store store;
+#endif
+};
+
+static bool s_bench_open;
+
+struct flashlog_bench *flashlog_bench_open(void)
+{
+    if(s_log_part == NULL || s_bench_open)
+        return NULL;
+    struct flashlog_bench *b = calloc(1, sizeof(*b));
+    if(b == NULL)
+        return NULL;
+    s_bench_open = true;
+    uint32_t base = FLASHLOG_CKPT_SECTORS + s_log.sectors, raw = FLASHLOG_BENCH_SECTORS - 2 * FLASHLOG_BENCH_TIER_SECTORS;
+    //empty rings, as flashlog_init and rollup_ring_init leave them on a blank partition
+    b->raw = (struct flashlog_ring){ .magic = FLASHLOG_BENCH_MAGIC, .base = base, .sectors = raw, .head = raw - 1,
+                                     .offset = FLASHLOG_RECORDS_PER_SECTOR, .first_seq = 1 };
+#if CONFIG_FLASHLOG_COMPACT
+    b->store.raw = &b->raw;
+    b->store.job.tier = -1;
+    for(int i = 0; i < ROLLUP_TIERS; i++)
+        b->store.tier[i] = (struct rollup_ring){ .base = base + raw + i * FLASHLOG_BENCH_TIER_SECTORS, .sectors = FLASHLOG_BENCH_TIER_SECTORS,
+                                                 .window_s = i ? CONFIG_ROLLUP_T2_WINDOW_S : CONFIG_ROLLUP_T1_WINDOW_S,
+                                                 .head = FLASHLOG_BENCH_TIER_SECTORS - 1, .offset = ROLLUP_RECORDS_PER_SECTOR, .first_seq = 1 };
+#endif
+    return b;
+}
+
+/*Append a sample and take one compaction step; an error of either is returned*/
+esp_err_t flashlog_bench_append(struct flashlog_bench *b, const struct data *sample)
+{
+    if(b->raw.offset >= FLASHLOG_RECORDS_PER_SECTOR)
+        capture_wait_clear();
+    esp_err_t err = flashlog_ring_append(&b->raw, sample);
+#if CONFIG_FLASHLOG_COMPACT
+    uint32_t errors = b->store.stats.errors;
+    if(rollup_step_erases(&b->store))
+        capture_wait_clear();
+    rollup_step(&b->store);
+    if(err == ESP_OK && b->store.stats.errors != errors)
+        err = ESP_FAIL;
+#endif
+    return err;
+}
+
+void flashlog_bench_close(struct flashlog_bench *b)
+{
+    free(b);
+    s_bench_open = false;
+}
+#endif
+/*Bench section END*/
+
+/*Open the flash log, then the rollup tiers behind it; a failed log leaves storage off until the next boot*/
+esp_err_t storage_init(void)
+{
+    esp_err_t err = flashlog_init();
+    if(err != ESP_OK)
+        return err;
+#if CONFIG_FLASHLOG_COMPACT
+    rollup_init();
+#endif
+#if CONFIG_FLASHLOG_FAULT_INJECT
+    flashlog_cut_check();
+#endif
+    return ESP_OK;
+}
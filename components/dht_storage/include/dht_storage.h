@@ -0,0 +1,99 @@
+/*
+Flash persistence: the raw sample log with heatmap checkpoints and, with FLASHLOG_COMPACT, its rollup tiers.
+*/
+#pragma once
+
+#include "dht_core.h"
+
+/*Flash log section*/
+/*Last two bytes of every record, programmed once the payload before it is in place*/
+struct flashlog_commit{
+    uint8_t crc;         //esp_crc8_le of the payload
+    uint8_t state;       //FLASHLOG_COMMITTED, 0xff while the record is being written
+};
+
+enum flashlog_slot{ FLASHLOG_SLOT_FREE, FLASHLOG_SLOT_COMMITTED, FLASHLOG_SLOT_TORN };
+
+struct flashlog_status{
+    uint32_t sector;      //head sector
+    uint32_t seq;         //and its sequence number
+    uint32_t record;      //next free record in it
+    uint32_t torn;        //records found torn at boot
+    uint32_t recovery_us;
+};
+
+esp_err_t storage_init(void);
+esp_err_t flashlog_init(void);
+bool flashlog_ready(void);
+esp_err_t flashlog_append(const struct data *sample);
+uint32_t flashlog_extent(uint32_t *first_seq);
+int flashlog_read(uint32_t first_seq, uint32_t offset, void *buf, uint32_t len);
+enum flashlog_slot flashlog_slot_state(const void *rec, size_t len);
+esp_err_t flashlog_stress_op(bool erase, uint32_t page);
+/*Largest blob a checkpoint holds: a flash sector less its 16 byte header*/
+#define FLASHLOG_CKPT_MAX (4096 - 16)
+
+esp_err_t flashlog_save_checkpoint(const void *blob, uint32_t len);
+esp_err_t flashlog_load_checkpoint(void *blob, uint32_t len);
+void flashlog_get_status(struct flashlog_status *out);
+
+/*Write boundaries of the flash log, the points FLASHLOG_FAULT_INJECT can cut power at*/
+enum flashlog_cut{
+    FLASHLOG_CUT_NONE, FLASHLOG_CUT_ERASE, FLASHLOG_CUT_HEADER, FLASHLOG_CUT_RECORD,
+#if CONFIG_FLASHLOG_COMPACT
+    FLASHLOG_CUT_ROLLUP_ERASE, FLASHLOG_CUT_ROLLUP_HEADER, FLASHLOG_CUT_ROLLUP_RECORD,
+#endif
+    FLASHLOG_CUTS
+};
+
+#if CONFIG_FLASHLOG_FAULT_INJECT
+struct flashlog_cut_report{
+    enum flashlog_cut cut;
+    bool ok;
+    uint32_t torn;
+    uint32_t recovery_us;
+};
+
+void flashlog_cut_arm(enum flashlog_cut at);
+const char *flashlog_cut_name(enum flashlog_cut at);
+void flashlog_cut_last(struct flashlog_cut_report *out);
+#endif
+
+/*Rollup section*/
+#define ROLLUP_TIERS 2
+
+/*Min, mean and max of the samples in one window; rollup sectors use the same header with base_ms = window_s*/
+struct rollup_record{
+    uint32_t start_s;     //wall-clock seconds at the start of the window
+    uint32_t src_seq;     //sector of the tier below it was made from
+    uint16_t count;       //samples
+    int16_t t_min, t_avg, t_max;    //tenths
+    uint16_t h_min, h_avg, h_max;   //tenths
+    struct flashlog_commit commit;
+} __attribute__((packed));
+
+struct rollup_acc{
+    uint32_t start_s;
+    uint32_t count;
+    int32_t t_sum;
+    uint32_t h_sum;
+    int16_t t_min, t_max;
+    uint16_t h_min, h_max;
+};
+
+void rollup_notify(void);
+#if CONFIG_FLASHLOG_COMPACT
+void rollup_init(void);
+uint32_t rollup_copy(int tier, uint32_t *seq, uint32_t *index, struct rollup_record *out, uint32_t max);
+uint32_t rollup_window_s(int tier);
+uint32_t rollup_version(int tier);
+int debug_format_compactor(char *out, size_t len);
+#endif
+
+/*Bench section*/
+#if CONFIG_LOADGEN_ENABLE
+struct flashlog_bench;
+struct flashlog_bench *flashlog_bench_open(void);
+esp_err_t flashlog_bench_append(struct flashlog_bench *b, const struct data *sample);
+void flashlog_bench_close(struct flashlog_bench *b);
+#endif
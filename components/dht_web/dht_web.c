@@ -0,0 +1,1968 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <esp_http_server.h>
+#include "dht_sensor.h"
+#include "dht_sampler.h"
+#include "dht_web.h"
+#if CONFIG_DHT_STORAGE_ENABLE
+#include "dht_storage.h"
+#endif
+#if CONFIG_DHT_EXPORTERS_ENABLE
+#include "dht_exporters.h"
+#endif
+#include "dht_diag.h"
+#if CONFIG_HTTPS_ENABLE
+#include "esp_https_server.h"
+#include "esp_tls.h"
+#include "mbedtls/ssl_ticket.h"
+#endif
+
+static const char *TAG = "web";
+
+/*Arena section START*/
+
+/*
+Per-request bump allocator. Blocks of ARENA_BLOCK_SIZE come from a small static pool; an arena takes a new
+block when the current one cannot fit an allocation and returns all of them in arena_release(). There is no
+per-allocation free. High-water marks are kept so the block size and count can be tuned from /api/v1/debug/arena.
+*/
+struct arena_stats{
+    uint32_t requests;
+    uint32_t failures;
+    uint32_t in_use;
+    uint32_t peak_in_use;         //blocks held at once across all arenas
+    uint32_t peak_blocks;         //blocks held by a single arena
+    uint32_t peak_bytes;          //bytes requested by a single arena
+};
+
+static uint8_t s_arena_pool[ARENA_BLOCKS][ARENA_BLOCK_SIZE] __attribute__((aligned(8)));
+static uint32_t s_arena_free = (1u << ARENA_BLOCKS) - 1;
+static struct arena_stats s_arena_stats;
+static portMUX_TYPE s_arena_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void arena_init(struct arena *a)
+{
+    memset(a, 0, sizeof(*a));
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    size = (size + 7) & ~7;
+    if(a->cur == NULL || a->used + size > ARENA_BLOCK_SIZE)
+    {
+        int block = -1;
+        portENTER_CRITICAL(&s_arena_mux);
+        if(size <= ARENA_BLOCK_SIZE && s_arena_free)
+        {
+            block = __builtin_ctz(s_arena_free);
+            s_arena_free &= ~(1u << block);
+            s_arena_stats.in_use++;
+            s_arena_stats.peak_in_use = MAX(s_arena_stats.peak_in_use, s_arena_stats.in_use);
+        }
+        else
+        {
+            s_arena_stats.failures++;
+        }
+        portEXIT_CRITICAL(&s_arena_mux);
+        if(block < 0)
+            return NULL;
+        a->blocks |= 1u << block;
+        a->cur = s_arena_pool[block];
+        a->used = 0;
+    }
+    void *p = a->cur + a->used;
+    a->used += size;
+    a->requested += size;
+    return p;
+}
+
+void arena_release(struct arena *a)
+{
+    uint32_t held = __builtin_popcount(a->blocks);
+    portENTER_CRITICAL(&s_arena_mux);
+    s_arena_free |= a->blocks;
+    s_arena_stats.in_use -= held;
+    s_arena_stats.requests++;
+    s_arena_stats.peak_blocks = MAX(s_arena_stats.peak_blocks, held);
+    s_arena_stats.peak_bytes = MAX(s_arena_stats.peak_bytes, a->requested);
+    portEXIT_CRITICAL(&s_arena_mux);
+    arena_init(a);
+}
+
+/*
+cJSON allocates through hooks. While an arena is bound, calls from the binding task are served from it and
+frees of arena memory are no-ops; everything else (eg. the console) still goes to the heap.
+*/
+static struct arena *s_cjson_arena;
+static TaskHandle_t s_cjson_owner;
+
+static void *cjson_malloc(size_t size)
+{
+    if(s_cjson_arena != NULL && xTaskGetCurrentTaskHandle() == s_cjson_owner)
+        return arena_alloc(s_cjson_arena, size);
+    return malloc(size);
+}
+
+static void cjson_free(void *ptr)
+{
+    if((uint8_t *)ptr >= &s_arena_pool[0][0] && (uint8_t *)ptr < &s_arena_pool[ARENA_BLOCKS][0])
+        return;
+    free(ptr);
+}
+
+void arena_bind_cjson(struct arena *a)
+{
+    s_cjson_owner = xTaskGetCurrentTaskHandle();
+    s_cjson_arena = a;
+}
+
+void arena_setup(void)
+{
+    cJSON_Hooks hooks = { .malloc_fn = cjson_malloc, .free_fn = cjson_free };
+    cJSON_InitHooks(&hooks);
+}
+
+int debug_format_arena(char *out, size_t len)
+{
+    portENTER_CRITICAL(&s_arena_mux);
+    struct arena_stats st = s_arena_stats;
+    portEXIT_CRITICAL(&s_arena_mux);
+    int n = 0;
+    APPEND(out, len, n, "{\"block_size\":%d,\"blocks\":%d,\"in_use\":%u,\"peak_in_use\":%u,\"peak_blocks_per_request\":%u,"
+           "\"peak_bytes_per_request\":%u,\"requests\":%u,\"failures\":%u}", ARENA_BLOCK_SIZE, ARENA_BLOCKS,
+           st.in_use, st.peak_in_use, st.peak_blocks, st.peak_bytes, st.requests, st.failures);
+    return n;
+}
+/*Arena section END*/
+
+/*Query cache section START*/
+#if CONFIG_QCACHE_SIZE > 0
+/*
+Rendered /api/v1/history, /heatmap and /rollups responses, keyed by route and normalized query (eg. "history:500:csv")
+and tagged with the version of the data they were rendered from. A new sample moves the history version, which history
+and heatmap responses depend on; a rollup tier's version only moves when the compactor writes to that tier, so rollup
+responses outlive many samples. Versions are checked on lookup, and stale entries go before anything live is evicted.
+Bodies sit back to back in a static pool and removing one slides the rest down. One request at a time captures its
+response into the free end of the pool as it is sent; others are served uncached meanwhile. A hit is copied out in
+arena blocks under the lock and sent without it, and is pinned until then so it cannot be evicted under the client.
+*/
+#define QCACHE_SIZE     CONFIG_QCACHE_SIZE
+#define QCACHE_ENTRIES  CONFIG_QCACHE_ENTRIES
+#define QCACHE_KEY_LEN  32
+
+enum qcache_source { QCACHE_HISTORY, QCACHE_ROLLUP1, QCACHE_ROLLUP2, QCACHE_SOURCES };
+
+struct qcache_entry{
+    char key[QCACHE_KEY_LEN];
+    const char *type;     //Content-Type, a literal
+    uint8_t source;
+    uint8_t pins;         //hits being sent
+    uint32_t id;          //what a pinned hit is found by, keys of stale entries may repeat
+    uint32_t version;
+    int64_t sync_us;      //clock_sync_mono_us() at render time, wall-clock times move with it
+    uint32_t offset;      //into the pool, entries are kept in offset order
+    uint32_t len;
+    uint32_t used;        //LRU tick
+};
+
+struct qcache_stats{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t stale;       //dropped because their data changed
+    uint32_t evictions;   //live entries dropped for room
+    uint32_t oversize;    //responses larger than the pool
+    uint32_t busy;        //misses not captured because another response was being captured
+};
+
+struct qcache_fill{
+    TaskHandle_t owner;   //NULL when idle
+    char key[QCACHE_KEY_LEN];
+    const char *type;
+    uint8_t source;
+    uint32_t version;
+    int64_t sync_us;
+    uint32_t offset;
+    uint32_t len;
+};
+
+static uint8_t s_qcache_pool[QCACHE_SIZE];
+static struct qcache_entry s_qcache[QCACHE_ENTRIES];
+static int s_qcache_count;
+static uint32_t s_qcache_tick;
+static uint32_t s_qcache_next_id;
+static struct qcache_fill s_qcache_fill;
+static struct qcache_stats s_qcache_stats;
+static SemaphoreHandle_t s_qcache_lock;
+static StaticSemaphore_t s_qcache_lock_buf;
+
+static esp_err_t send_arena_exhausted(httpd_req_t *req);
+
+static void qcache_init(void)
+{
+    s_qcache_lock = xSemaphoreCreateMutexStatic(&s_qcache_lock_buf);
+}
+
+/*Taken before rendering, so a sample arriving meanwhile leaves the entry looking stale rather than fresh*/
+static uint32_t qcache_version(enum qcache_source source)
+{
+#if CONFIG_DHT_STORAGE_ENABLE && CONFIG_FLASHLOG_COMPACT
+    if(source != QCACHE_HISTORY)
+        return rollup_version(source - QCACHE_ROLLUP1);
+#endif
+    sampler_lock();
+    uint32_t seq = history_seq();
+    sampler_unlock();
+    return seq;
+}
+
+/*End of the bytes in use, the capture in progress included; called with s_qcache_lock held*/
+static uint32_t qcache_end(void)
+{
+    if(s_qcache_fill.owner)
+        return s_qcache_fill.offset + s_qcache_fill.len;
+    return s_qcache_count ? s_qcache[s_qcache_count - 1].offset + s_qcache[s_qcache_count - 1].len : 0;
+}
+
+/*Called with s_qcache_lock held*/
+static void qcache_remove(int i)
+{
+    struct qcache_entry *e = &s_qcache[i];
+    uint32_t from = e->offset + e->len, len = e->len;
+    memmove(s_qcache_pool + e->offset, s_qcache_pool + from, qcache_end() - from);
+    s_qcache_count--;
+    memmove(e, e + 1, (s_qcache_count - i) * sizeof(*e));
+    for(int j = i; j < s_qcache_count; j++)
+        s_qcache[j].offset -= len;
+    if(s_qcache_fill.owner)
+        s_qcache_fill.offset -= len;
+}
+
+/*Least recently used unpinned entry, -1 if every entry is being sent; called with s_qcache_lock held*/
+static int qcache_victim(void)
+{
+    int victim = -1;
+    for(int i = 0; i < s_qcache_count; i++)
+        if(s_qcache[i].pins == 0 && (victim < 0 || (int32_t)(s_qcache[i].used - s_qcache[victim].used) < 0))
+            victim = i;
+    return victim;
+}
+
+static bool qcache_fresh(const struct qcache_entry *e, const uint32_t *version, int64_t sync_us)
+{
+    return e->version == version[e->source] && e->sync_us == sync_us;
+}
+
+/*
+Serve key from the cache. On a miss returns ESP_ERR_NOT_FOUND and, unless another response is being captured, starts
+capturing this one: the handler renders it as usual through qcache_chunk().
+*/
+static esp_err_t qcache_serve(httpd_req_t *req, struct arena *a, enum qcache_source source, const char *key, const char *type)
+{
+    uint32_t version[QCACHE_SOURCES];
+    for(int i = 0; i < QCACHE_SOURCES; i++)
+        version[i] = qcache_version(i);
+    int64_t sync_us = clock_sync_mono_us();
+
+    xSemaphoreTake(s_qcache_lock, portMAX_DELAY);
+    struct qcache_entry *hit = NULL;
+    for(int i = 0; i < s_qcache_count; i++)
+    {
+        struct qcache_entry *e = &s_qcache[i];
+        if(e->pins == 0 && !qcache_fresh(e, version, sync_us))
+        {
+            qcache_remove(i--);
+            s_qcache_stats.stale++;
+        }
+        else if(strcmp(e->key, key) == 0 && qcache_fresh(e, version, sync_us))
+            hit = e;
+    }
+    if(hit == NULL)
+    {
+        s_qcache_stats.misses++;
+        if(s_qcache_fill.owner == NULL)
+        {
+            s_qcache_fill = (struct qcache_fill){ .owner = xTaskGetCurrentTaskHandle(), .type = type, .source = source,
+                                                  .version = version[source], .sync_us = sync_us, .offset = qcache_end() };
+            strlcpy(s_qcache_fill.key, key, QCACHE_KEY_LEN);
+        }
+        else
+            s_qcache_stats.busy++;
+        xSemaphoreGive(s_qcache_lock);
+        httpd_resp_set_hdr(req, "X-Cache", "miss");
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_qcache_stats.hits++;
+    hit->used = ++s_qcache_tick;
+    hit->pins++;
+    uint32_t id = hit->id, len = hit->len;
+    xSemaphoreGive(s_qcache_lock);
+
+    httpd_resp_set_type(req, type);
+    httpd_resp_set_hdr(req, "X-Cache", "hit");
+    char *buf = arena_alloc(a, ARENA_BLOCK_SIZE);
+    esp_err_t ret = buf ? ESP_OK : ESP_ERR_NO_MEM;
+    for(uint32_t sent = 0; ret == ESP_OK && sent < len; )
+    {
+        uint32_t n = MIN(len - sent, ARENA_BLOCK_SIZE);
+        //pinned, so it is still there, although earlier removals may have slid it down
+        xSemaphoreTake(s_qcache_lock, portMAX_DELAY);
+        for(int i = 0; i < s_qcache_count; i++)
+            if(s_qcache[i].id == id)
+            {
+                memcpy(buf, s_qcache_pool + s_qcache[i].offset + sent, n);
+                break;
+            }
+        xSemaphoreGive(s_qcache_lock);
+        ret = httpd_resp_send_chunk(req, buf, n);
+        sent += n;
+    }
+
+    xSemaphoreTake(s_qcache_lock, portMAX_DELAY);
+    for(int i = 0; i < s_qcache_count; i++)
+        if(s_qcache[i].id == id)
+        {
+            s_qcache[i].pins--;
+            break;
+        }
+    xSemaphoreGive(s_qcache_lock);
+    if(ret == ESP_ERR_NO_MEM)
+        return send_arena_exhausted(req);
+    if(ret != ESP_OK)
+        return ESP_FAIL;
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/*Drop the capture this task started, if any; run after every handler so an early return cannot leave it claimed*/
+static void qcache_abandon(void)
+{
+    if(s_qcache_fill.owner != xTaskGetCurrentTaskHandle())
+        return;
+    xSemaphoreTake(s_qcache_lock, portMAX_DELAY);
+    s_qcache_fill.owner = NULL;
+    xSemaphoreGive(s_qcache_lock);
+}
+
+/*Append to the capture, evicting for room; a response that cannot fit is not cached. Called with s_qcache_lock held*/
+static void qcache_capture(const char *buf, size_t len)
+{
+    while(s_qcache_fill.offset + s_qcache_fill.len + len > QCACHE_SIZE)
+    {
+        int victim = qcache_victim();
+        if(victim < 0 || s_qcache_fill.len + len > QCACHE_SIZE)
+        {
+            s_qcache_stats.oversize++;
+            s_qcache_fill.owner = NULL;
+            return;
+        }
+        qcache_remove(victim);
+        s_qcache_stats.evictions++;
+    }
+    memcpy(s_qcache_pool + s_qcache_fill.offset + s_qcache_fill.len, buf, len);
+    s_qcache_fill.len += len;
+}
+
+/*Turn the finished capture into an entry; called with s_qcache_lock held*/
+static void qcache_commit(void)
+{
+    s_qcache_fill.owner = NULL;
+    if(s_qcache_count == QCACHE_ENTRIES)
+    {
+        int victim = qcache_victim();
+        if(victim < 0)
+            return;
+        qcache_remove(victim);
+        s_qcache_stats.evictions++;
+    }
+    struct qcache_entry *e = &s_qcache[s_qcache_count++];
+    *e = (struct qcache_entry){ .type = s_qcache_fill.type, .source = s_qcache_fill.source, .version = s_qcache_fill.version,
+                                .sync_us = s_qcache_fill.sync_us, .offset = s_qcache_fill.offset, .len = s_qcache_fill.len,
+                                .id = ++s_qcache_next_id, .used = ++s_qcache_tick };
+    strlcpy(e->key, s_qcache_fill.key, QCACHE_KEY_LEN);
+}
+
+/*httpd_resp_send_chunk for cacheable routes: also captures the body if qcache_serve() started a capture for this task*/
+static esp_err_t qcache_chunk(httpd_req_t *req, const char *buf, ssize_t len)
+{
+    if(len == HTTPD_RESP_USE_STRLEN && buf)
+        len = strlen(buf);
+    esp_err_t ret = httpd_resp_send_chunk(req, buf, len);
+    if(s_qcache_fill.owner != xTaskGetCurrentTaskHandle())
+        return ret;
+    xSemaphoreTake(s_qcache_lock, portMAX_DELAY);
+    if(ret != ESP_OK)
+        s_qcache_fill.owner = NULL;
+    else if(buf == NULL)
+        qcache_commit();
+    else
+        qcache_capture(buf, len);
+    xSemaphoreGive(s_qcache_lock);
+    return ret;
+}
+
+int debug_format_qcache(char *out, size_t len)
+{
+    //the console is up before the server
+    if(s_qcache_lock == NULL)
+        return snprintf(out, len, "{\"size\":%d,\"entries\":[]}", QCACHE_SIZE);
+    xSemaphoreTake(s_qcache_lock, portMAX_DELAY);
+    struct qcache_stats st = s_qcache_stats;
+    int n = 0;
+    APPEND(out, len, n, "{\"size\":%d,\"used\":%u,\"hits\":%u,\"misses\":%u,\"hit_pct\":%u,\"stale\":%u,\"evictions\":%u,"
+           "\"oversize\":%u,\"busy\":%u,\"entries\":[", QCACHE_SIZE, s_qcache_count ? s_qcache[s_qcache_count - 1].offset +
+           s_qcache[s_qcache_count - 1].len : 0, st.hits, st.misses, st.hits + st.misses ? st.hits * 100 / (st.hits + st.misses) : 0,
+           st.stale, st.evictions, st.oversize, st.busy);
+    for(int i = 0; i < s_qcache_count; i++)
+        APPEND(out, len, n, "%s{\"key\":\"%s\",\"bytes\":%u}", i ? "," : "", s_qcache[i].key, s_qcache[i].len);
+    xSemaphoreGive(s_qcache_lock);
+    APPEND(out, len, n, "]}");
+    return n;
+}
+#else
+#define qcache_init()
+#define qcache_abandon()
+#define qcache_serve(req, a, source, key, type) ESP_ERR_NOT_FOUND
+#define qcache_chunk httpd_resp_send_chunk
+#endif
+/*Query cache section END*/
+
+
+
+/*HTTP Server section START*/
+
+/*
+Every handler gets a fresh per-request arena whose blocks are all returned once it is done, plus the path
+parameters captured by the router ({name} segments of its pattern, empty for routes outside the API).
+*/
+#define ROUTE_MAX_PARAMS     2
+#define ROUTE_PARAM_LEN      32
+
+struct route_params{
+    int count;
+    const char *name[ROUTE_MAX_PARAMS];   //points into the pattern, ends at '}'
+    char value[ROUTE_MAX_PARAMS][ROUTE_PARAM_LEN];
+};
+
+typedef esp_err_t (*route_handler_t)(httpd_req_t *req, struct arena *a, const struct route_params *params);
+
+/*Value of path parameter {name}, NULL if the route has none by that name*/
+const char *route_param(const struct route_params *params, const char *name)
+{
+    size_t len = strlen(name);
+    for(int i = 0; i < params->count; i++)
+        if(strncmp(params->name[i], name, len) == 0 && params->name[i][len] == '}')
+            return params->value[i];
+    return NULL;
+}
+
+#if CONFIG_HTTPS_ENABLE
+/*
+TLS handshake cost. esp_tls_server_session_create and the mbedTLS ticket callbacks are wrapped at link time
+(see components/dht_web/CMakeLists.txt). Each httpd instance runs its own handshakes one at a time in its own task,
+so a thread-local flag carries "the client's ticket was accepted" from the parse callback to the end of the handshake.
+*/
+struct tls_stats{
+    uint32_t full;              //certificate and key exchange
+    uint32_t resumed;           //client presented a valid session ticket
+    uint32_t failures;
+    uint32_t tickets_issued;
+    uint32_t tickets_rejected;  //expired, or sealed under a key from before a reboot
+    uint64_t full_us;
+    uint64_t resumed_us;
+    uint32_t full_max_us;
+    uint32_t resumed_max_us;
+};
+
+static struct tls_stats s_tls_stats;
+static portMUX_TYPE s_tls_mux = portMUX_INITIALIZER_UNLOCKED;
+static __thread bool s_tls_ticket_accepted;
+
+int __real_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls);
+int __real_mbedtls_ssl_ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf, size_t len);
+int __real_mbedtls_ssl_ticket_write(void *p_ticket, const mbedtls_ssl_session *session, unsigned char *start,
+                                    const unsigned char *end, size_t *tlen, uint32_t *lifetime);
+
+int __wrap_mbedtls_ssl_ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf, size_t len)
+{
+    int ret = __real_mbedtls_ssl_ticket_parse(p_ticket, session, buf, len);
+    s_tls_ticket_accepted = ret == 0;
+    if(ret != 0)
+        __atomic_fetch_add(&s_tls_stats.tickets_rejected, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+int __wrap_mbedtls_ssl_ticket_write(void *p_ticket, const mbedtls_ssl_session *session, unsigned char *start,
+                                    const unsigned char *end, size_t *tlen, uint32_t *lifetime)
+{
+    int ret = __real_mbedtls_ssl_ticket_write(p_ticket, session, start, end, tlen, lifetime);
+    if(ret == 0)
+        __atomic_fetch_add(&s_tls_stats.tickets_issued, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+/*Wall time of the handshake in the httpd task, which includes the client's round trips*/
+int __wrap_esp_tls_server_session_create(esp_tls_cfg_server_t *cfg, int sockfd, esp_tls_t *tls)
+{
+    s_tls_ticket_accepted = false;
+    int64_t start = esp_timer_get_time();
+    int ret = __real_esp_tls_server_session_create(cfg, sockfd, tls);
+    uint32_t us = esp_timer_get_time() - start;
+
+    portENTER_CRITICAL(&s_tls_mux);
+    if(ret != 0)
+        s_tls_stats.failures++;
+    else if(s_tls_ticket_accepted)
+    {
+        s_tls_stats.resumed++;
+        s_tls_stats.resumed_us += us;
+        s_tls_stats.resumed_max_us = MAX(s_tls_stats.resumed_max_us, us);
+    }
+    else
+    {
+        s_tls_stats.full++;
+        s_tls_stats.full_us += us;
+        s_tls_stats.full_max_us = MAX(s_tls_stats.full_max_us, us);
+    }
+    portEXIT_CRITICAL(&s_tls_mux);
+    return ret;
+}
+#endif
+
+/*
+Handler latency per httpd instance, from the router picking the handler to the handler returning, so it includes
+sending the response. Buckets are powers of 4 from 1 ms, the last one is everything from 1 s up.
+*/
+#define HTTPD_LATENCY_BUCKETS 7
+
+struct httpd_latency{
+    uint32_t requests;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[HTTPD_LATENCY_BUCKETS];
+};
+
+static struct httpd_latency s_httpd_latency[HTTPD_INSTANCES];
+static portMUX_TYPE s_httpd_latency_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static void httpd_record_request(enum httpd_instance id, uint32_t us)
+{
+    int bucket = 0;
+    for(uint32_t limit = 1000; bucket < HTTPD_LATENCY_BUCKETS - 1 && us >= limit; limit *= 4)
+        bucket++;
+    portENTER_CRITICAL(&s_httpd_latency_mux);
+    struct httpd_latency *l = &s_httpd_latency[id];
+    l->requests++;
+    l->total_us += us;
+    l->max_us = MAX(l->max_us, us);
+    l->buckets[bucket]++;
+    portEXIT_CRITICAL(&s_httpd_latency_mux);
+}
+
+/*
+Two server instances: API takes the page, /metrics and the small /api/v1 routes, BULK the exports and streams,
+so a long download never holds up a scrape. Each has its own task, core, port and socket budget.
+*/
+struct httpd_instance_cfg{
+    const char *name;
+    uint16_t port;
+    uint16_t ctrl_port;
+    int core;
+    size_t stack_size;
+    uint16_t sockets;
+};
+
+static const struct httpd_instance_cfg s_httpd_cfg[HTTPD_INSTANCES] = {
+    { "api",  HTTPD_API_PORT,         32768, CONFIG_HTTPD_API_CORE,  CONFIG_HTTPD_STACK_SIZE,      CONFIG_HTTPD_API_SOCKETS },
+    { "bulk", CONFIG_HTTPD_BULK_PORT, 32769, CONFIG_HTTPD_BULK_CORE, CONFIG_HTTPD_BULK_STACK_SIZE, CONFIG_HTTPD_BULK_SOCKETS },
+};
+
+static httpd_handle_t s_httpd[HTTPD_INSTANCES];
+static TaskHandle_t s_httpd_task[HTTPD_INSTANCES];   //seen on the first request, for the console benchmark
+
+TaskHandle_t httpd_task(enum httpd_instance id)
+{
+    return s_httpd_task[id];
+}
+
+static enum httpd_instance httpd_instance_of(httpd_req_t *req)
+{
+    return req->handle == s_httpd[HTTPD_BULK] ? HTTPD_BULK : HTTPD_API;
+}
+
+static esp_err_t run_handler(httpd_req_t *req, route_handler_t handler, const struct route_params *params)
+{
+    enum httpd_instance id = httpd_instance_of(req);
+    s_httpd_task[id] = xTaskGetCurrentTaskHandle();
+    int64_t start = esp_timer_get_time();
+    struct arena a;
+    arena_init(&a);
+    esp_err_t ret = handler(req, &a, params);
+    qcache_abandon();
+    arena_release(&a);
+    httpd_record_request(id, esp_timer_get_time() - start);
+    return ret;
+}
+
+/*Handler for URIs registered directly with httpd, user_ctx is the route_handler_t*/
+static esp_err_t arena_dispatch(httpd_req_t *req)
+{
+    static const struct route_params no_params;
+    return run_handler(req, (route_handler_t)req->user_ctx, &no_params);
+}
+
+/*Send an arena allocation failure as 503 so clients retry instead of treating it as a bad request*/
+static esp_err_t send_arena_exhausted(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_send(req, "arena exhausted", HTTPD_RESP_USE_STRLEN);
+}
+
+#define QUERY_SIZE 128
+
+/*The query string in the request's arena, "" without one; NULL when the arena is exhausted*/
+static char *query_get(httpd_req_t *req, struct arena *a)
+{
+    char *query = arena_alloc(a, QUERY_SIZE);
+    if(query && httpd_req_get_url_query_str(req, query, QUERY_SIZE) != ESP_OK)
+        query[0] = 0;
+    return query;
+}
+
+/*
+?fields=a,b of a JSON route, see the Fields section of dht_core; mask keeps the route's default without one.
+Answers 400 and returns false when the list names a field the route does not have.
+*/
+static bool query_fields(httpd_req_t *req, const char *query, bool (*parse)(const char *list, uint32_t *mask), uint32_t *mask)
+{
+    char list[QUERY_SIZE];
+    esp_err_t err = httpd_query_key_value(query, "fields", list, sizeof(list));
+    if(err == ESP_ERR_NOT_FOUND || (err == ESP_OK && parse(list, mask)))
+        return true;
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "fields: unknown field");
+    return false;
+}
+
+/*
+Single byte ranges for the binary downloads: "bytes=a-b", "bytes=a-" and "bytes=-n". Sets ETag and Accept-Ranges,
+plus status and Content-Range for 206 and 416. The Range is ignored, and the whole body sent, when If-Range names
+another version, when several ranges are asked for or when it does not parse; 200 is always a valid answer.
+httpd keeps pointers to header values, so hdr is RANGE_HDR_SIZE bytes from the request's arena.
+Returns 200, 206 or 416, with [*start, *end) the bytes to send.
+*/
+#define RANGE_HDR_SIZE 160
+
+static int range_prepare(httpd_req_t *req, char *hdr, const char *etag, uint32_t total, uint32_t *start, uint32_t *end)
+{
+    char *etag_hdr = hdr, *range = hdr + 32, *content_range = hdr + 96;
+    snprintf(etag_hdr, 32, "\"%s\"", etag);
+    httpd_resp_set_hdr(req, "ETag", etag_hdr);
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    *start = 0;
+    *end = total;
+
+    if(httpd_req_get_hdr_value_str(req, "Range", range, 64) != ESP_OK || strncmp(range, "bytes=", 6) != 0 || strchr(range, ','))
+        return 200;
+    //only an exact ETag keeps the range, modification dates are not tracked
+    if(httpd_req_get_hdr_value_len(req, "If-Range") &&
+       (httpd_req_get_hdr_value_str(req, "If-Range", content_range, 64) != ESP_OK || strcmp(content_range, etag_hdr) != 0))
+        return 200;
+
+    //positions are plain digits: strtoul would also take a sign or spaces, and a position past 32 bits saturates it
+    char *first = range + 6, *dash = strchr(first, '-'), *tail;
+    if(dash == NULL || (dash != first && !isdigit((unsigned char)*first)) || (dash[1] && !isdigit((unsigned char)dash[1])) ||
+       (dash == first && dash[1] == 0))
+        return 200;
+    errno = 0;
+    uint32_t a = strtoul(first, &tail, 10);
+    if(errno == ERANGE)
+        return 200;
+    if(dash == first)
+    {
+        //suffix range, the last n bytes
+        uint32_t n = strtoul(dash + 1, &tail, 10);
+        if(*tail || errno == ERANGE)
+            return 200;
+        a = total - MIN(n, total);
+        if(n == 0)
+            a = total;
+    }
+    else if(tail != dash)
+        return 200;
+    else if(dash[1])
+    {
+        uint32_t b = strtoul(dash + 1, &tail, 10);
+        if(*tail || errno == ERANGE || b < a)
+            return 200;
+        *end = b >= total ? total : b + 1;
+    }
+
+    if(a >= total)
+    {
+        snprintf(content_range, 64, "bytes */%u", total);
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        *start = *end = 0;
+        return 416;
+    }
+    *start = a;
+    snprintf(content_range, 64, "bytes %u-%u/%u", *start, *end - 1, total);
+    httpd_resp_set_hdr(req, "Content-Range", content_range);
+    httpd_resp_set_status(req, "206 Partial Content");
+    return 206;
+}
+
+/* Our URI handler function to be called during GET /uri request */
+esp_err_t get_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    struct data currentData;
+    get_latest(&currentData);
+    if(currentData.status==DHT_OK)
+    {    
+        printf("Temp=" TENTHS_FMT ", Humi=" TENTHS_FMT "\r\n",TENTHS_ARGS(currentData.temperature),TENTHS_ARGS(currentData.humidity));
+    }
+    else
+    {
+        printf("DHT11 Error!\r\n");
+    }
+    //char htmlPage[]="URI GET Response";
+    char sampled[32] = "never";
+    if(currentData.status != DHT_ERR_NO_DATA)
+    {
+        time_t t = clock_wall_us(currentData.mono_us) / 1000000;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        strftime(sampled, sizeof(sampled), clock_is_synced() ? "%Y-%m-%d %H:%M:%S UTC" : "%Y-%m-%d %H:%M:%S (unsynced)", &tm);
+    }
+    char *htmlPage = arena_alloc(a, ARENA_BLOCK_SIZE);
+    if(htmlPage == NULL)
+        return send_arena_exhausted(req);
+    snprintf(htmlPage,ARENA_BLOCK_SIZE,"<<!DOCTYPE html><html>\n<head>\n<style>\nhtml {font-family: sans-serif; text-align: center;}\n</style>\n</head>\n<body>\n<div>\n<h1>ESP32 IoT Server</h1>\n</div>\n<div>\n<h3>Temperature and Humidity Monitor</h3>\n<p>DHT11 Temperature Reading: " TENTHS_FMT "&deg;C</p>\n<p>DHT11 Humidity Reading: " TENTHS_FMT "%%</p>\n<p>Sampled: %s</p>\n</div>\n</body>\n</html> >",TENTHS_ARGS(currentData.temperature),TENTHS_ARGS(currentData.humidity),sampled);
+    httpd_resp_send(req, htmlPage, HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+/* URI handler structure for GET /uri */
+httpd_uri_t uri_get = {
+    .uri      = "/",
+    .method   = HTTP_GET,
+    .handler  = arena_dispatch,
+    .user_ctx = get_handler
+};
+
+#if CONFIG_DHT_EXPORTERS_ENABLE
+/*GET /metrics and /api/v1/current: the body the sampler rendered, the same bytes the fast path sends*/
+static esp_err_t send_snapshot(httpd_req_t *req, struct arena *a, enum snapshot_doc_id id)
+{
+    char *buf = arena_alloc(a, SNAPSHOT_DOC_SIZE);
+    if(buf == NULL)
+        return send_arena_exhausted(req);
+    int n = snapshot_copy(id, false, buf, SNAPSHOT_DOC_SIZE);
+    httpd_resp_set_type(req, snapshot_type(id));
+    return httpd_resp_send(req, buf, n);
+}
+
+esp_err_t metrics_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    return send_snapshot(req, a, SNAPSHOT_METRICS);
+}
+
+/*A projection is rendered per request, only the full document is pre-rendered*/
+esp_err_t current_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    char *query = query_get(req, a);
+    if(query == NULL)
+        return send_arena_exhausted(req);
+    uint32_t mask = 0;
+    if(!query_fields(req, query, sample_fields_parse, &mask))
+        return ESP_OK;
+    if(mask == 0)
+        return send_snapshot(req, a, SNAPSHOT_CURRENT);
+    char *buf = arena_alloc(a, 160);
+    if(buf == NULL)
+        return send_arena_exhausted(req);
+    int n = snapshot_format_current(mask, buf, 160);
+    httpd_resp_set_type(req, snapshot_type(SNAPSHOT_CURRENT));
+    return httpd_resp_send(req, buf, MIN(n, 159));
+}
+
+/* Prometheus scrape endpoint, outside /api/ where scrapers expect it */
+httpd_uri_t uri_metrics = {
+    .uri      = "/metrics",
+    .method   = HTTP_GET,
+    .handler  = arena_dispatch,
+    .user_ctx = metrics_handler
+};
+#endif
+
+/* GET /api/v1/heatmap: seconds spent per temperature band (columns) per day (rows), oldest day first */
+#if CONFIG_DHT_STORAGE_ENABLE
+/*
+GET /api/v1/log: the flash log as stored, see flashlog_extent for the layout. Range and If-Range let a collector
+resume a broken download or fetch segments in parallel; the ETag names the oldest sector, so it only changes
+when that sector is reused.
+*/
+esp_err_t log_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    char *hdr = arena_alloc(a, RANGE_HDR_SIZE);
+    char *buf = arena_alloc(a, ARENA_BLOCK_SIZE);
+    if(hdr == NULL || buf == NULL)
+        return send_arena_exhausted(req);
+
+    uint32_t first_seq, start, end;
+    uint32_t total = flashlog_extent(&first_seq);
+    char etag[16];
+    snprintf(etag, sizeof(etag), "l%u", first_seq);
+    int status = range_prepare(req, hdr, etag, total, &start, &end);
+    httpd_resp_set_type(req, "application/octet-stream");
+    if(status == 416)
+        return httpd_resp_send(req, NULL, 0);
+
+    while(start < end)
+    {
+        int n = flashlog_read(first_seq, start, buf, MIN(end - start, ARENA_BLOCK_SIZE));
+        //the sector was reused mid-download, a short body tells the client to start over
+        if(n <= 0 || httpd_resp_send_chunk(req, buf, n) != ESP_OK)
+            return ESP_FAIL;
+        start += n;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
+#if CONFIG_DHT_STORAGE_ENABLE && CONFIG_FLASHLOG_COMPACT
+/*
+GET /api/v1/rollups?tier=1|2&fields=: the rollups of one tier, oldest first, as
+{"window_s":W,"rollups":[{"t":start_s,"n":samples,"temperature":[min,avg,max],"humidity":[min,avg,max]},...]}.
+A window cut by a sector boundary of the tier below is stored twice and merged here.
+*/
+#define ROLLUP_BATCH 16
+
+static int rollup_format_t(char *out, size_t len, const void *rec)
+{
+    return snprintf(out, len, "%u", ((const struct rollup_acc *)rec)->start_s);
+}
+
+static int rollup_format_n(char *out, size_t len, const void *rec)
+{
+    return snprintf(out, len, "%u", ((const struct rollup_acc *)rec)->count);
+}
+
+static int rollup_format_temperature(char *out, size_t len, const void *rec)
+{
+    const struct rollup_acc *r = rec;
+    return snprintf(out, len, "[" TENTHS_FMT "," TENTHS_FMT "," TENTHS_FMT "]", TENTHS_ARGS(r->t_min),
+                    TENTHS_ARGS((int16_t)(r->t_sum / (int32_t)r->count)), TENTHS_ARGS(r->t_max));
+}
+
+static int rollup_format_humidity(char *out, size_t len, const void *rec)
+{
+    const struct rollup_acc *r = rec;
+    return snprintf(out, len, "[" TENTHS_FMT "," TENTHS_FMT "," TENTHS_FMT "]", TENTHS_ARGS(r->h_min),
+                    TENTHS_ARGS((uint16_t)(r->h_sum / r->count)), TENTHS_ARGS(r->h_max));
+}
+
+static const struct json_field s_rollup_fields[] = {
+    JSON_FIELD("t", rollup_format_t),
+    JSON_FIELD("n", rollup_format_n),
+    JSON_FIELD("temperature", rollup_format_temperature),
+    JSON_FIELD("humidity", rollup_format_humidity),
+};
+#define ROLLUP_FIELDS (sizeof(s_rollup_fields) / sizeof(s_rollup_fields[0]))
+
+static bool rollup_fields_parse(const char *list, uint32_t *mask)
+{
+    return fields_parse(list, s_rollup_fields, sizeof(s_rollup_fields[0]), ROLLUP_FIELDS, mask);
+}
+
+esp_err_t rollups_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    char *query = query_get(req, a);
+    char *out = arena_alloc(a, ARENA_BLOCK_SIZE);
+    struct rollup_record *batch = arena_alloc(a, ROLLUP_BATCH * sizeof(struct rollup_record));
+    if(query == NULL || out == NULL || batch == NULL)
+        return send_arena_exhausted(req);
+    char value[4] = "1";
+    httpd_query_key_value(query, "tier", value, sizeof(value));
+    int tier = atoi(value) - 1;
+    if(tier < 0 || tier >= ROLLUP_TIERS)
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "tier must be 1 or 2");
+    uint32_t mask = FIELDS_MASK(ROLLUP_FIELDS);
+    if(!query_fields(req, query, rollup_fields_parse, &mask))
+        return ESP_OK;
+    if(!flashlog_ready())
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "flash log unavailable");
+    char key[20];
+    snprintf(key, sizeof(key), "rollups:%d:%x", tier + 1, mask);
+    esp_err_t ret = qcache_serve(req, a, QCACHE_ROLLUP1 + tier, key, "application/json");
+    if(ret != ESP_ERR_NOT_FOUND)
+        return ret;
+
+    httpd_resp_set_type(req, "application/json");
+    int n = snprintf(out, ARENA_BLOCK_SIZE, "{\"window_s\":%u,\"rollups\":[", rollup_window_s(tier));
+    uint32_t seq = 0, index = 0;
+    bool first = true;
+    struct rollup_acc pending = { 0 };
+    for(;;)
+    {
+        uint32_t count = rollup_copy(tier, &seq, &index, batch, ROLLUP_BATCH);
+        for(uint32_t i = 0; i <= count; i++)
+        {
+            const struct rollup_record *rec = i < count ? &batch[i] : NULL;
+            if(rec && flashlog_slot_state(rec, sizeof(*rec)) != FLASHLOG_SLOT_COMMITTED)
+                continue;
+            if(rec && pending.count && rec->start_s == pending.start_s)
+            {
+                pending.count += rec->count;
+                pending.t_sum += rec->t_avg * rec->count;
+                pending.h_sum += rec->h_avg * rec->count;
+                pending.t_min = MIN(pending.t_min, rec->t_min);
+                pending.t_max = MAX(pending.t_max, rec->t_max);
+                pending.h_min = MIN(pending.h_min, rec->h_min);
+                pending.h_max = MAX(pending.h_max, rec->h_max);
+                continue;
+            }
+            //the last pass only flushes the final window once the tier is exhausted
+            if(pending.count && (rec || count == 0))
+            {
+                if(n > ARENA_BLOCK_SIZE - 128)
+                {
+                    qcache_chunk(req, out, n);
+                    n = 0;
+                }
+                if(!first)
+                    out[n++] = ',';
+                n += fields_format_json(out + n, ARENA_BLOCK_SIZE - n, s_rollup_fields, mask, &pending);
+                first = false;
+                pending.count = 0;
+            }
+            if(rec)
+                pending = (struct rollup_acc){ .start_s = rec->start_s, .count = rec->count, .t_sum = rec->t_avg * rec->count,
+                                               .h_sum = rec->h_avg * rec->count, .t_min = rec->t_min, .t_max = rec->t_max,
+                                               .h_min = rec->h_min, .h_max = rec->h_max };
+        }
+        if(count == 0)
+            break;
+    }
+    n += snprintf(out + n, ARENA_BLOCK_SIZE - n, "]}");
+    qcache_chunk(req, out, n);
+    return qcache_chunk(req, NULL, 0);
+}
+#endif
+
+esp_err_t heatmap_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    //copied a day at a time, the whole heatmap can be larger than an arena block
+    uint32_t *ms = arena_alloc(a, HEATMAP_BANDS * sizeof(uint32_t));
+    char *line = arena_alloc(a, 128);
+    if(ms == NULL || line == NULL)
+        return send_arena_exhausted(req);
+    esp_err_t ret = qcache_serve(req, a, QCACHE_HISTORY, "heatmap", "application/json");
+    if(ret != ESP_ERR_NOT_FOUND)
+        return ret;
+
+    httpd_resp_set_type(req, "application/json");
+    snprintf(line, 128, "{\"band_min_c\":%d,\"band_width_c\":%d,\"bands\":%d,\"unit\":\"s\",\"rows\":[",
+             CONFIG_HEATMAP_BAND_MIN_C, CONFIG_HEATMAP_BAND_WIDTH_C, HEATMAP_BANDS);
+    qcache_chunk(req, line, HTTPD_RESP_USE_STRLEN);
+
+    //newest day decides where the ring starts
+    uint32_t newest = heatmap_newest_day();
+    bool first = true;
+    for(uint32_t d = newest + 1 - MIN(newest + 1, HEATMAP_DAYS); newest != HEATMAP_DAY_NONE && d <= newest; d++)
+    {
+        if(!heatmap_get_day(d, ms))
+            continue;
+        int n = snprintf(line, 128, "%s{\"day\":%u,\"s\":[", first ? "" : ",", d);
+        for(int b = 0; b < HEATMAP_BANDS; b++)
+        {
+            if(n > 128 - 16)
+            {
+                qcache_chunk(req, line, n);
+                n = 0;
+            }
+            n += snprintf(line + n, 128 - n, "%s%u", b ? "," : "", ms[b] / 1000);
+        }
+        n += snprintf(line + n, 128 - n, "]}");
+        qcache_chunk(req, line, n);
+        first = false;
+    }
+    qcache_chunk(req, "]}", 2);
+    return qcache_chunk(req, NULL, 0);
+}
+
+/*
+GET /api/v1/history?limit=N&format=json|csv|bin&fields=: newest N samples (all held when omitted), oldest first.
+CSV is also chosen by "Accept: text/csv". Samples are copied out in batches so the lock is never held while sending.
+fields= projects the JSON rows over sample_fields; CSV and bin always carry time, temperature and humidity.
+*/
+#define HISTORY_BATCH 32
+#define HISTORY_FIELDS ((1u << SAMPLE_FIELD_T) | (1u << SAMPLE_FIELD_TEMPERATURE) | (1u << SAMPLE_FIELD_HUMIDITY))
+
+/*Little-endian, byte offset / sizeof(record) is the sample's position in the download*/
+struct history_bin_record{
+    int64_t t_ms;         //wall-clock ms
+    int16_t temperature;  //tenths
+    uint16_t humidity;    //tenths
+} __attribute__((packed));
+
+/*
+format=bin: fixed-size records with Range support. The download starts at the oldest held sample rounded up to a
+multiple of HISTORY_BATCH, so the ETag (that start and the last clock sync) stays valid for HISTORY_BATCH samples
+after the ring is full, and bytes already sent under it never change. limit does not apply.
+*/
+static esp_err_t history_send_bin(httpd_req_t *req, struct arena *a, struct data *batch, struct history_bin_record *out)
+{
+    char *hdr = arena_alloc(a, RANGE_HDR_SIZE);
+    if(hdr == NULL)
+        return send_arena_exhausted(req);
+
+    sampler_lock();
+    uint32_t newest = history_seq();
+    uint32_t anchor = MIN((newest - history_count() + HISTORY_BATCH - 1) / HISTORY_BATCH * HISTORY_BATCH, newest);
+    sampler_unlock();
+
+    char etag[24];
+    snprintf(etag, sizeof(etag), "h%u-%u", anchor, (uint32_t)(clock_sync_mono_us() / 1000));
+    uint32_t start, end;
+    int status = range_prepare(req, hdr, etag, (newest - anchor) * sizeof(*out), &start, &end);
+    httpd_resp_set_type(req, "application/octet-stream");
+    if(status == 416)
+        return httpd_resp_send(req, NULL, 0);
+
+    //ranges need not be record aligned, send from the record holding start
+    uint32_t seq = anchor + start / sizeof(*out);
+    uint32_t skip = start % sizeof(*out), left = end - start;
+    while(left)
+    {
+        uint32_t want = seq;
+        sampler_lock();
+        uint32_t count = history_copy(&seq, batch, HISTORY_BATCH);
+        sampler_unlock();
+        //overwritten while sending, drop the connection so the client sees a short body rather than a gap
+        if(count == 0 || seq - count != want)
+            return ESP_FAIL;
+        for(uint32_t i = 0; i < count; i++)
+            out[i] = (struct history_bin_record){ .t_ms = clock_wall_us(batch[i].mono_us) / 1000,
+                                                  .temperature = batch[i].temperature, .humidity = batch[i].humidity };
+        uint32_t bytes = MIN(count * sizeof(*out) - skip, left);
+        if(httpd_resp_send_chunk(req, (const char *)out + skip, bytes) != ESP_OK)
+            return ESP_FAIL;
+        skip = 0;
+        left -= bytes;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t history_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    char *query = query_get(req, a);
+    char *value = arena_alloc(a, 16);
+    char *out = arena_alloc(a, ARENA_BLOCK_SIZE);
+    struct data *batch = arena_alloc(a, HISTORY_BATCH * sizeof(struct data));
+    if(query == NULL || value == NULL || out == NULL || batch == NULL)
+        return send_arena_exhausted(req);
+
+    uint32_t limit = UINT32_MAX, mask = HISTORY_FIELDS;
+    bool csv = false;
+    if(httpd_query_key_value(query, "limit", value, 16) == ESP_OK)
+        limit = strtoul(value, NULL, 10);
+    if(httpd_query_key_value(query, "format", value, 16) == ESP_OK)
+    {
+        if(strcmp(value, "bin") == 0)
+            return history_send_bin(req, a, batch, (struct history_bin_record *)out);
+        csv = strcmp(value, "csv") == 0;
+    }
+    if(!query_fields(req, query, sample_fields_parse, &mask))
+        return ESP_OK;
+    value[0] = 0;
+    httpd_req_get_hdr_value_str(req, "Accept", value, 16); //truncation is fine, only the prefix matters
+    if(strncmp(value, "text/csv", 8) == 0)
+        csv = true;
+
+    //"all" and any limit past what is held render the same samples, so they share an entry
+    sampler_lock();
+    uint32_t held = MIN(limit, history_count());
+    sampler_unlock();
+    char key[32];
+    if(csv)
+        snprintf(key, sizeof(key), "history:%u:csv", held);
+    else
+        snprintf(key, sizeof(key), "history:%u:json:%x", held, mask);
+    esp_err_t ret = qcache_serve(req, a, QCACHE_HISTORY, key, csv ? "text/csv" : "application/json");
+    if(ret != ESP_ERR_NOT_FOUND)
+        return ret;
+
+    sampler_lock();
+    uint32_t seq = history_seq() - MIN(limit, history_count());
+    sampler_unlock();
+
+    httpd_resp_set_type(req, csv ? "text/csv" : "application/json");
+    int n = snprintf(out, ARENA_BLOCK_SIZE, csv ? "t_ms,temperature,humidity\n" : "{\"samples\":[");
+    bool first = true;
+    for(;;)
+    {
+        sampler_lock();
+        uint32_t count = history_copy(&seq, batch, HISTORY_BATCH);
+        sampler_unlock();
+        if(count == 0)
+            break;
+        for(uint32_t i = 0; i < count; i++)
+        {
+            //one line is well under 128 bytes, flush before it could be truncated
+            if(n > ARENA_BLOCK_SIZE - 128)
+            {
+                qcache_chunk(req, out, n);
+                n = 0;
+            }
+            if(csv)
+                n += snprintf(out + n, ARENA_BLOCK_SIZE - n, "%lld," TENTHS_FMT "," TENTHS_FMT "\n",
+                              (long long)(clock_wall_us(batch[i].mono_us) / 1000),
+                              TENTHS_ARGS(batch[i].temperature), TENTHS_ARGS(batch[i].humidity));
+            else
+            {
+                if(!first)
+                    out[n++] = ',';
+                n += fields_format_json(out + n, ARENA_BLOCK_SIZE - n, sample_fields, mask, &batch[i]);
+            }
+            first = false;
+        }
+    }
+    if(!csv)
+        n += snprintf(out + n, ARENA_BLOCK_SIZE - n, "]}");
+    qcache_chunk(req, out, n);
+    return qcache_chunk(req, NULL, 0);
+}
+
+/* GET /api/v1/config?fields=: current runtime configuration */
+esp_err_t config_get_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    char *query = query_get(req, a);
+    char *json = arena_alloc(a, 256);
+    if(query == NULL || json == NULL)
+        return send_arena_exhausted(req);
+    uint32_t mask = 0;
+    if(!query_fields(req, query, config_fields_parse, &mask))
+        return ESP_OK;
+    if(mask)
+        config_format_json_fields(json, 256, mask);
+    else
+        config_format_json(json, 256);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+
+/* PUT /api/v1/config: partial update, eg. {"sample_interval":2000}. Responds with the new config */
+#define CONFIG_BODY_MAX 512
+
+esp_err_t config_put_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    if(req->content_len >= CONFIG_BODY_MAX)
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "body too large");
+    char *body = arena_alloc(a, req->content_len + 1);
+    char *err = arena_alloc(a, 96);
+    char *resp = arena_alloc(a, 288);
+    if(body == NULL || err == NULL || resp == NULL)
+        return send_arena_exhausted(req);
+    int received = 0;
+    while(received < req->content_len)
+    {
+        int ret = httpd_req_recv(req, body + received, req->content_len - received);
+        if(ret == HTTPD_SOCK_ERR_TIMEOUT)
+            continue;
+        if(ret <= 0)
+            return ESP_FAIL;
+        received += ret;
+    }
+    body[received] = 0;
+
+    //cJSON nodes come out of this request's arena and go away with it
+    arena_bind_cjson(a);
+    cJSON *json = cJSON_Parse(body);
+    strlcpy(err, "invalid JSON", 96);
+    bool reboot = false;
+    esp_err_t ret = json ? config_update(json, err, 96, &reboot) : ESP_ERR_INVALID_ARG;
+    cJSON_Delete(json);
+    arena_bind_cjson(NULL);
+    if(ret == ESP_ERR_INVALID_ARG)
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, err);
+    if(ret != ESP_OK)
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, err);
+
+    int n = snprintf(resp, 288, "{\"reboot_required\":%s,\"config\":", reboot ? "true" : "false");
+    n += config_format_json(resp + n, 288 - n - 1);
+    strlcat(resp, "}", 288);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, resp, HTTPD_RESP_USE_STRLEN);
+}
+
+#if CONFIG_DHT_DIAG_ENABLE
+/* GET /api/v1/debug/{name}: one of the debug formatters, see dht_diag */
+esp_err_t debug_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    const struct debug_formatter *f = debug_find(route_param(params, "name"));
+    if(f == NULL)
+        return httpd_resp_send_404(req);
+    char *out = arena_alloc(a, ARENA_BLOCK_SIZE);
+    if(out == NULL)
+        return send_arena_exhausted(req);
+    int n = f->format(out, ARENA_BLOCK_SIZE);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, out, MIN(n, ARENA_BLOCK_SIZE - 1));
+}
+#endif
+
+/* GET /api/v1/sensors/{id}?fields=: latest reading of one sensor, the DHT on this node is sensor 0 */
+esp_err_t sensor_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    const char *id = route_param(params, "id");
+    struct data last;
+#if CONFIG_DHT_FUSION
+    //physical sensors by index, the fused one as "fused"
+    char *end;
+    long index = strtol(id, &end, 10);
+    if(strcmp(id, "fused") == 0)
+        get_latest(&last);
+    else if(end == id || *end || !fusion_get(index, &last))
+        return httpd_resp_send_404(req);
+#else
+    if(strcmp(id, "0") != 0)
+        return httpd_resp_send_404(req);
+    get_latest(&last);
+#endif
+    char *query = query_get(req, a);
+    char *out = arena_alloc(a, 160);
+    if(query == NULL || out == NULL)
+        return send_arena_exhausted(req);
+    uint32_t mask = FIELDS_MASK(SAMPLE_FIELDS);
+    if(!query_fields(req, query, sample_fields_parse, &mask))
+        return ESP_OK;
+    fields_format_json(out, 160, sample_fields, mask, &last);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, out, HTTPD_RESP_USE_STRLEN);
+}
+
+
+#if CONFIG_STREAM_ENABLE
+/*
+GET /api/v1/stream?fields=&coalesce_ms=: Server-Sent Events, one "sample" event per sample reaching the history ring
+with its history sequence number as the id, so a client reconnecting with Last-Event-ID carries on where it stopped.
+Samples from several sensors arrive in bursts and a write per event would cost a TCP segment and a WiFi transaction
+each. Events go into a per-connection buffer instead, written as one frame (one HTTP chunk) once the oldest has
+waited the connection's latency budget or the buffer is half full. The stream task formats and times the frames;
+the writes themselves are queued onto the bulk httpd task, the only one that may touch its sessions (and TLS state).
+Each connection has two buffers, one filling while the other is written. Events that fit in neither are dropped and
+counted, the client sees the gap in ids. A frame httpd would not queue stays in the fill buffer and is tried again.
+*/
+#define STREAM_CLIENTS       CONFIG_STREAM_MAX_CLIENTS
+_Static_assert(STREAM_CLIENTS < CONFIG_HTTPD_BULK_SOCKETS, "STREAM_MAX_CLIENTS must leave a bulk socket for downloads");
+#define STREAM_BUFFER_SIZE   CONFIG_STREAM_BUFFER_SIZE
+#define STREAM_CHUNK_HDR     6        //room for "ffff\r\n" in front of the body
+#define STREAM_KEEPALIVE_MS  15000    //comment line sent to an idle stream, so proxies and dead peers notice
+#define STREAM_EVENT_MAX     192
+
+struct stream_buf{
+    char text[STREAM_CHUNK_HDR + STREAM_BUFFER_SIZE + 2];
+    uint16_t len;             //body bytes, after the chunk header room
+};
+
+struct stream_totals{
+    uint32_t events;
+    uint32_t frames;
+    uint32_t dropped;
+    uint32_t requeues;        //frames httpd_queue_work refused, sent on a later pass
+    uint64_t bytes;
+    uint64_t added_us;        //summed wait of the oldest event in every frame
+    uint32_t max_added_us;
+};
+
+struct stream_conn{
+    bool open;
+    bool writing;             //the other buffer is queued on the httpd task
+    uint8_t fill;             //buffer events go into
+    uint32_t gen;             //bumped on every open, writes queued for an earlier connection are dropped
+    int fd;
+    uint32_t seq;             //next history sample to send
+    uint32_t mask;            //sample_fields
+    uint32_t budget_us;
+    int64_t opened_us;
+    int64_t first_us;         //when the oldest event in the fill buffer was queued
+    int64_t last_write_us;
+    struct stream_totals st;
+    struct stream_buf buf[2];
+};
+
+static struct stream_conn s_stream[STREAM_CLIENTS];
+static struct stream_totals s_stream_closed;    //connections that are gone
+static SemaphoreHandle_t s_stream_lock;
+static StaticSemaphore_t s_stream_lock_buf;
+static StackType_t s_stream_stack[3072];
+static StaticTask_t s_stream_tcb;
+static TaskHandle_t s_stream_task;
+
+static void stream_add_totals(struct stream_totals *to, const struct stream_totals *from)
+{
+    to->events += from->events;
+    to->frames += from->frames;
+    to->dropped += from->dropped;
+    to->requeues += from->requeues;
+    to->bytes += from->bytes;
+    to->added_us += from->added_us;
+    to->max_added_us = MAX(to->max_added_us, from->max_added_us);
+}
+
+/*httpd closed the session (free_ctx), runs on the bulk httpd task*/
+static void stream_closed(void *ctx)
+{
+    struct stream_conn *c = ctx;
+    xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+    c->open = false;
+    stream_add_totals(&s_stream_closed, &c->st);
+    xSemaphoreGive(s_stream_lock);
+}
+
+/*httpd_queue_work callback: write the frame that is not filling. arg is the slot and the generation it was queued for*/
+static void stream_write(void *arg)
+{
+    uint32_t slot = (uintptr_t)arg & 0xff, gen = (uintptr_t)arg >> 8;
+    struct stream_conn *c = &s_stream[slot];
+    xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+    bool live = c->open && c->gen == gen;
+    struct stream_buf *b = &c->buf[!c->fill];
+    int fd = c->fd;
+    xSemaphoreGive(s_stream_lock);
+
+    if(live)
+    {
+        //chunk header right in front of the body
+        char hdr[STREAM_CHUNK_HDR + 1];
+        int h = snprintf(hdr, sizeof(hdr), "%x\r\n", b->len);
+        char *frame = b->text + STREAM_CHUNK_HDR - h;
+        memcpy(frame, hdr, h);
+        memcpy(b->text + STREAM_CHUNK_HDR + b->len, "\r\n", 2);
+        int len = h + b->len + 2, sent = 0;
+        while(sent < len)
+        {
+            int n = httpd_socket_send(s_httpd[HTTPD_BULK], fd, frame + sent, len - sent, 0);
+            if(n <= 0)
+            {
+                httpd_sess_trigger_close(s_httpd[HTTPD_BULK], fd);
+                break;
+            }
+            sent += n;
+        }
+    }
+
+    xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+    if(c->gen == gen)
+        c->writing = false;
+    xSemaphoreGive(s_stream_lock);
+    //the stream task may be holding a full buffer back
+    xTaskNotifyGive(s_stream_task);
+}
+
+/*
+Queue the fill buffer for writing and start filling the other; called with s_stream_lock held. stream_write only
+looks at the buffer that is not filling, so flipping under the lock before it runs is safe. If the work cannot be
+queued nothing changes and the frame goes out on a later pass.
+*/
+static void stream_flush(struct stream_conn *c, int64_t now)
+{
+    uintptr_t arg = (uintptr_t)(c - s_stream) | (c->gen << 8);
+    if(httpd_queue_work(s_httpd[HTTPD_BULK], stream_write, (void *)arg) != ESP_OK)
+    {
+        c->st.requeues++;
+        return;
+    }
+    uint32_t added_us = now - c->first_us;
+    c->st.frames++;
+    c->st.bytes += c->buf[c->fill].len;
+    c->st.added_us += added_us;
+    c->st.max_added_us = MAX(c->st.max_added_us, added_us);
+    c->fill ^= 1;
+    c->buf[c->fill].len = 0;
+    c->writing = true;
+    c->last_write_us = now;
+}
+
+/*Append to the fill buffer, false if it does not fit; called with s_stream_lock held*/
+static bool stream_append(struct stream_conn *c, const char *text, int len, int64_t now)
+{
+    struct stream_buf *b = &c->buf[c->fill];
+    if(len >= STREAM_EVENT_MAX || b->len + len > STREAM_BUFFER_SIZE)
+        return false;
+    if(b->len == 0)
+        c->first_us = now;
+    memcpy(b->text + STREAM_CHUNK_HDR + b->len, text, len);
+    b->len += len;
+    return true;
+}
+
+/*Format the samples a connection has not seen yet into its fill buffer*/
+static void stream_collect(struct stream_conn *c, struct data *batch, char *event)
+{
+    for(;;)
+    {
+        xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+        uint32_t seq = c->seq, mask = c->mask, gen = c->gen;
+        bool open = c->open;
+        xSemaphoreGive(s_stream_lock);
+        if(!open)
+            return;
+        sampler_lock();
+        uint32_t count = history_copy(&seq, batch, HISTORY_BATCH);
+        sampler_unlock();
+        if(count == 0)
+            return;
+
+        int64_t now = esp_timer_get_time();
+        xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+        //closed and maybe reopened while the lock was released, the new connection has its own cursor
+        if(!c->open || c->gen != gen)
+        {
+            xSemaphoreGive(s_stream_lock);
+            return;
+        }
+        for(uint32_t i = 0; i < count; i++)
+        {
+            int n = snprintf(event, STREAM_EVENT_MAX, "id: %u\nevent: sample\ndata: ", seq - count + i);
+            n += fields_format_json(event + n, STREAM_EVENT_MAX - MIN(n, STREAM_EVENT_MAX), sample_fields, mask, &batch[i]);
+            n += snprintf(event + MIN(n, STREAM_EVENT_MAX), STREAM_EVENT_MAX - MIN(n, STREAM_EVENT_MAX), "\n\n");
+            if(stream_append(c, event, n, now))
+                c->st.events++;
+            else
+                c->st.dropped++;
+        }
+        c->seq = seq;
+        xSemaphoreGive(s_stream_lock);
+    }
+}
+
+static void stream_task(void *arg)
+{
+    static struct data batch[HISTORY_BATCH];
+    static char event[STREAM_EVENT_MAX];
+    for(;;)
+    {
+        for(int i = 0; i < STREAM_CLIENTS; i++)
+            stream_collect(&s_stream[i], batch, event);
+
+        //write what is due, and sleep until the next budget runs out or more samples arrive
+        int64_t now = esp_timer_get_time(), wake = now + STREAM_KEEPALIVE_MS * 1000LL;
+        xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+        for(int i = 0; i < STREAM_CLIENTS; i++)
+        {
+            struct stream_conn *c = &s_stream[i];
+            if(!c->open)
+                continue;
+            struct stream_buf *b = &c->buf[c->fill];
+            //backdated so it goes out now
+            if(b->len == 0 && now - c->last_write_us >= STREAM_KEEPALIVE_MS * 1000LL)
+                stream_append(c, ":\n\n", 3, now - c->budget_us);
+            if(b->len == 0 || c->writing)
+            {
+                wake = MIN(wake, c->last_write_us + STREAM_KEEPALIVE_MS * 1000LL);
+                continue;
+            }
+            if(now - c->first_us >= c->budget_us || b->len >= STREAM_BUFFER_SIZE / 2)
+            {
+                stream_flush(c, now);
+                if(!c->writing)
+                    wake = now;     //not queued, try again on the next tick
+            }
+            else
+                wake = MIN(wake, c->first_us + c->budget_us);
+        }
+        xSemaphoreGive(s_stream_lock);
+        ulTaskNotifyTake(pdTRUE, MAX(pdMS_TO_TICKS((wake - now + 999) / 1000), 1));
+    }
+}
+
+static void stream_start(void)
+{
+    s_stream_lock = xSemaphoreCreateMutexStatic(&s_stream_lock_buf);
+    s_stream_task = xTaskCreateStatic(stream_task, "stream", sizeof(s_stream_stack), NULL, 5, s_stream_stack, &s_stream_tcb);
+    sampler_add_listener(s_stream_task);
+}
+
+esp_err_t stream_handler(httpd_req_t *req, struct arena *a, const struct route_params *params)
+{
+    char *query = query_get(req, a);
+    char *value = arena_alloc(a, 16);
+    if(query == NULL || value == NULL)
+        return send_arena_exhausted(req);
+    uint32_t mask = FIELDS_MASK(SAMPLE_FIELDS), budget_ms = CONFIG_STREAM_COALESCE_MS;
+    if(!query_fields(req, query, sample_fields_parse, &mask))
+        return ESP_OK;
+    if(httpd_query_key_value(query, "coalesce_ms", value, 16) == ESP_OK)
+        budget_ms = MIN(strtoul(value, NULL, 10), 1000);
+    sampler_lock();
+    uint32_t seq = history_seq();
+    sampler_unlock();
+    //an id from before a reboot can be ahead of the ring, start from the newest then
+    if(httpd_req_get_hdr_value_str(req, "Last-Event-ID", value, 16) == ESP_OK)
+    {
+        uint32_t next = strtoul(value, NULL, 10) + 1;
+        if((int32_t)(seq - next) >= 0)
+            seq = next;
+    }
+
+    struct stream_conn *c = NULL;
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+    for(int i = 0; i < STREAM_CLIENTS && c == NULL; i++)
+        if(!s_stream[i].open)
+            c = &s_stream[i];
+    if(c)
+    {
+        c->open = true;
+        c->writing = false;
+        c->gen++;
+        c->fd = httpd_req_to_sockfd(req);
+        c->seq = seq;
+        c->mask = mask;
+        c->budget_us = budget_ms * 1000;
+        c->opened_us = c->last_write_us = now;
+        c->st = (struct stream_totals){ 0 };
+        c->buf[c->fill].len = 0;
+    }
+    xSemaphoreGive(s_stream_lock);
+    if(c == NULL)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, "too many streams", HTTPD_RESP_USE_STRLEN);
+    }
+
+    //headers and a first chunk now; frames queued later run on this task after the handler returns
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if(httpd_resp_send_chunk(req, ":\n\n", 3) != ESP_OK)
+    {
+        stream_closed(c);
+        return ESP_FAIL;
+    }
+    req->sess_ctx = c;
+    req->free_ctx = stream_closed;
+    xTaskNotifyGive(s_stream_task);
+    return ESP_OK;
+}
+
+/*Frames per second, bytes per frame and the latency coalescing added, over all streams and per open one*/
+int debug_format_stream(char *out, size_t len)
+{
+    if(s_stream_lock == NULL)
+        return snprintf(out, len, "{\"clients\":[]}");
+    int64_t now = esp_timer_get_time();
+    int n = 0;
+    xSemaphoreTake(s_stream_lock, portMAX_DELAY);
+    struct stream_totals all = s_stream_closed;
+    for(int i = 0; i < STREAM_CLIENTS; i++)
+        if(s_stream[i].open)
+            stream_add_totals(&all, &s_stream[i].st);
+    APPEND(out, len, n, "{\"budget_ms\":%d,\"events\":%u,\"frames\":%u,\"dropped\":%u,\"requeues\":%u,\"events_per_frame_x10\":%u,"
+           "\"bytes_per_frame\":%u,\"added_avg_us\":%u,\"added_max_us\":%u,\"clients\":[", CONFIG_STREAM_COALESCE_MS,
+           all.events, all.frames, all.dropped, all.requeues, all.frames ? all.events * 10 / all.frames : 0,
+           all.frames ? (uint32_t)(all.bytes / all.frames) : 0, all.frames ? (uint32_t)(all.added_us / all.frames) : 0,
+           all.max_added_us);
+    bool first = true;
+    for(int i = 0; i < STREAM_CLIENTS; i++)
+    {
+        const struct stream_conn *c = &s_stream[i];
+        if(!c->open)
+            continue;
+        uint32_t up_ms = MAX((now - c->opened_us) / 1000, 1);
+        APPEND(out, len, n, "%s{\"fd\":%d,\"budget_ms\":%u,\"seconds\":%u,\"events\":%u,\"frames\":%u,\"frames_per_s_x10\":%u,"
+               "\"bytes_per_frame\":%u,\"added_avg_us\":%u,\"added_max_us\":%u,\"dropped\":%u}", first ? "" : ",", c->fd,
+               c->budget_us / 1000, up_ms / 1000, c->st.events, c->st.frames, (uint32_t)((uint64_t)c->st.frames * 10000 / up_ms),
+               c->st.frames ? (uint32_t)(c->st.bytes / c->st.frames) : 0,
+               c->st.frames ? (uint32_t)(c->st.added_us / c->st.frames) : 0, c->st.max_added_us, c->st.dropped);
+        first = false;
+    }
+    xSemaphoreGive(s_stream_lock);
+    APPEND(out, len, n, "]}");
+    return n;
+}
+#endif
+
+
+/*
+API router. httpd sees one wildcard URI per version prefix and method (eg. /api/v1/ + '*'); the version's route table is
+sorted once at start by (method, first path segment) and each request binary-searches that key, then matches the
+remaining segments of the few candidates. {name} segments match any single segment and are captured as parameters.
+*/
+struct route{
+    httpd_method_t method;
+    const char *pattern;    //relative to the version prefix, first segment must be literal
+    route_handler_t handler;
+    enum httpd_instance server;
+};
+
+struct api_version{
+    const char *prefix;     //eg. "/api/v1"
+    const struct route *routes;
+    size_t count;
+    const struct route **sorted;
+};
+
+static const struct route s_routes_v1[] = {
+    { HTTP_GET, "/heatmap",       heatmap_handler,    HTTPD_API },
+    { HTTP_GET, "/history",       history_handler,    HTTPD_BULK },
+#if CONFIG_STREAM_ENABLE
+    { HTTP_GET, "/stream",        stream_handler,     HTTPD_BULK },
+#endif
+#if CONFIG_DHT_STORAGE_ENABLE
+    { HTTP_GET, "/log",           log_handler,        HTTPD_BULK },
+#if CONFIG_FLASHLOG_COMPACT
+    { HTTP_GET, "/rollups",       rollups_handler,    HTTPD_BULK },
+#endif
+#endif
+#if CONFIG_DHT_EXPORTERS_ENABLE
+    { HTTP_GET, "/current",       current_handler,    HTTPD_API },
+#endif
+    { HTTP_GET, "/config",        config_get_handler, HTTPD_API },
+    { HTTP_PUT, "/config",        config_put_handler, HTTPD_API },
+#if CONFIG_DHT_DIAG_ENABLE
+    { HTTP_GET, "/debug/{name}",  debug_handler,      HTTPD_API },
+#endif
+    { HTTP_GET, "/sensors/{id}",  sensor_handler,     HTTPD_API },
+};
+#define ROUTES_V1_COUNT (sizeof(s_routes_v1) / sizeof(s_routes_v1[0]))
+
+static const struct route *s_routes_v1_sorted[ROUTES_V1_COUNT];
+
+static struct api_version s_api_versions[] = {
+    { "/api/v1", s_routes_v1, ROUTES_V1_COUNT, s_routes_v1_sorted },
+};
+#define API_VERSION_COUNT (sizeof(s_api_versions) / sizeof(s_api_versions[0]))
+
+/*Length of the first segment of a path starting with '/', excluding the slash*/
+static size_t first_segment_len(const char *path, size_t len)
+{
+    size_t i = 1;
+    while(i < len && path[i] != '/' && path[i] != '?')
+        i++;
+    return i - 1;
+}
+
+/*Order by method, then by first segment; both the sort and the lookup use this key*/
+static int route_key_cmp(httpd_method_t method, const char *seg, size_t seg_len, const struct route *r)
+{
+    if(method != r->method)
+        return method < r->method ? -1 : 1;
+    size_t r_len = first_segment_len(r->pattern, strlen(r->pattern));
+    int c = strncmp(seg, r->pattern + 1, MIN(seg_len, r_len));
+    if(c != 0)
+        return c;
+    return seg_len == r_len ? 0 : (seg_len < r_len ? -1 : 1);
+}
+
+static int route_sort_cmp(const void *x, const void *y)
+{
+    const struct route *a = *(const struct route * const *)x, *b = *(const struct route * const *)y;
+    return route_key_cmp(a->method, a->pattern + 1, first_segment_len(a->pattern, strlen(a->pattern)), b);
+}
+
+/*Match the remaining segments of path (no query) against pattern, capturing {name} segments*/
+static bool route_match(const char *pattern, const char *path, size_t len, struct route_params *params)
+{
+    params->count = 0;
+    const char *end = path + len;
+    while(*pattern && path < end)
+    {
+        if(*pattern++ != '/' || *path++ != '/')
+            return false;
+        const char *seg = path;
+        while(path < end && *path != '/')
+            path++;
+        if(*pattern == '{')
+        {
+            if(params->count == ROUTE_MAX_PARAMS || path == seg || path - seg >= ROUTE_PARAM_LEN)
+                return false;
+            params->name[params->count] = pattern + 1;
+            memcpy(params->value[params->count], seg, path - seg);
+            params->value[params->count][path - seg] = 0;
+            params->count++;
+            pattern = strchr(pattern, '}') + 1;
+        }
+        else
+        {
+            size_t seg_len = path - seg;
+            if(strncmp(pattern, seg, seg_len) != 0 || (pattern[seg_len] != '/' && pattern[seg_len] != 0))
+                return false;
+            pattern += seg_len;
+        }
+    }
+    return *pattern == 0 && path == end;
+}
+
+/*
+Find the route for method and path (relative to the version prefix, query stripped). Returns NULL and sets
+*wrong_method when the path exists under another method only.
+*/
+const struct route *router_lookup(const struct api_version *v, httpd_method_t method, const char *path, size_t len,
+                                  struct route_params *params, bool *wrong_method)
+{
+    *wrong_method = false;
+    if(len == 0 || path[0] != '/')
+        return NULL;
+    size_t seg_len = first_segment_len(path, len);
+
+    //lower bound of (method, first segment)
+    size_t lo = 0, hi = v->count;
+    while(lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if(route_key_cmp(method, path + 1, seg_len, v->sorted[mid]) > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for(size_t i = lo; i < v->count && route_key_cmp(method, path + 1, seg_len, v->sorted[i]) == 0; i++)
+        if(route_match(v->sorted[i]->pattern, path, len, params))
+            return v->sorted[i];
+
+    //only on a miss: tell 404 from 405
+    for(size_t i = 0; i < v->count; i++)
+        if(v->routes[i].method != method && route_match(v->routes[i].pattern, path, len, params))
+            *wrong_method = true;
+    return NULL;
+}
+
+/*A route asked for on the other instance: 307 to the same path on that instance's port, so old URLs keep working*/
+static esp_err_t send_instance_redirect(httpd_req_t *req, enum httpd_instance target)
+{
+    char host[64] = "";
+    char location[sizeof(host) + sizeof(req->uri) + 16];
+    httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host));
+    //drop the port of the instance the client reached, keep IPv6 brackets
+    char *colon = strrchr(host, ':');
+    if(colon && !strchr(colon, ']'))
+        *colon = 0;
+#if CONFIG_HTTPS_ENABLE
+    snprintf(location, sizeof(location), "https://%s:%u%s", host, s_httpd_cfg[target].port, req->uri);
+#else
+    snprintf(location, sizeof(location), "http://%s:%u%s", host, s_httpd_cfg[target].port, req->uri);
+#endif
+    httpd_resp_set_status(req, "307 Temporary Redirect");
+    httpd_resp_set_hdr(req, "Location", location);
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/*httpd handler for the version prefix wildcard, user_ctx is the api_version*/
+static esp_err_t router_dispatch(httpd_req_t *req)
+{
+    const struct api_version *v = req->user_ctx;
+    const char *path = req->uri + strlen(v->prefix);
+    size_t len = strcspn(path, "?");
+    struct route_params params;
+    bool wrong_method;
+    const struct route *r = router_lookup(v, req->method, path, len, &params, &wrong_method);
+    if(r == NULL)
+    {
+        if(wrong_method)
+            return httpd_resp_send_err(req, HTTPD_405_METHOD_NOT_ALLOWED, "method not allowed");
+        return httpd_resp_send_404(req);
+    }
+    if(r->server != httpd_instance_of(req))
+        return send_instance_redirect(req, r->server);
+    return run_handler(req, r->handler, &params);
+}
+
+/*Sort each version's table once, before any instance can look routes up*/
+static void router_init(void)
+{
+    for(int i = 0; i < API_VERSION_COUNT; i++)
+    {
+        struct api_version *v = &s_api_versions[i];
+        for(size_t j = 0; j < v->count; j++)
+            v->sorted[j] = &v->routes[j];
+        qsort(v->sorted, v->count, sizeof(v->sorted[0]), route_sort_cmp);
+    }
+}
+
+/*
+Register one wildcard handler per prefix and method in use. The API instance takes every method so it can
+redirect bulk routes, the bulk instance only the methods of its own routes.
+*/
+static void router_register(httpd_handle_t server, enum httpd_instance id)
+{
+    static char uris[API_VERSION_COUNT][24];
+    static const httpd_method_t methods[] = { HTTP_GET, HTTP_PUT, HTTP_POST, HTTP_DELETE };
+    for(int i = 0; i < API_VERSION_COUNT; i++)
+    {
+        struct api_version *v = &s_api_versions[i];
+        snprintf(uris[i], sizeof(uris[i]), "%s/*", v->prefix);
+        for(int m = 0; m < sizeof(methods) / sizeof(methods[0]); m++)
+        {
+            bool used = false;
+            for(size_t j = 0; j < v->count; j++)
+                used = used || (v->routes[j].method == methods[m] && (id == HTTPD_API || v->routes[j].server == id));
+            if(!used)
+                continue;
+            httpd_uri_t uri = {
+                .uri      = uris[i],
+                .method   = methods[m],
+                .handler  = router_dispatch,
+                .user_ctx = v
+            };
+            httpd_register_uri_handler(server, &uri);
+        }
+    }
+}
+
+
+
+#if CONFIG_HTTPS_ENABLE
+/*PEM files embedded by components/dht_web/CMakeLists.txt*/
+extern const uint8_t servercert_start[] asm("_binary_servercert_pem_start");
+extern const uint8_t servercert_end[]   asm("_binary_servercert_pem_end");
+extern const uint8_t prvtkey_start[]    asm("_binary_prvtkey_pem_start");
+extern const uint8_t prvtkey_end[]      asm("_binary_prvtkey_pem_end");
+#endif
+
+/* Start one server instance with its own port, core, stack and socket budget */
+static httpd_handle_t start_instance(enum httpd_instance id)
+{
+    const struct httpd_instance_cfg *inst = &s_httpd_cfg[id];
+    /* Generate default configuration */
+#if CONFIG_HTTPS_ENABLE
+    httpd_ssl_config_t ssl_config = HTTPD_SSL_CONFIG_DEFAULT();
+    ssl_config.servercert = servercert_start;
+    ssl_config.servercert_len = servercert_end - servercert_start;
+    ssl_config.prvtkey_pem = prvtkey_start;
+    ssl_config.prvtkey_len = prvtkey_end - prvtkey_start;
+    ssl_config.port_secure = inst->port;
+    /* Pollers come back with a ticket and skip the certificate and key exchange */
+    ssl_config.session_tickets = true;
+    httpd_config_t *config = &ssl_config.httpd;
+    /* Every open session holds its mbedTLS buffers, so keep few and let a new client evict the idle one */
+    config->lru_purge_enable = true;
+#else
+    httpd_config_t plain_config = HTTPD_DEFAULT_CONFIG();
+    httpd_config_t *config = &plain_config;
+    config->server_port = inst->port;
+#endif
+    config->ctrl_port = inst->ctrl_port;
+    config->core_id = inst->core;
+    config->stack_size = inst->stack_size;
+    config->max_open_sockets = inst->sockets;
+    config->max_uri_handlers = 8;
+    config->uri_match_fn = httpd_uri_match_wildcard;
+
+    /* Empty handle to esp_http_server */
+    httpd_handle_t server = NULL;
+
+    /* Start the httpd server, connections stay open between requests (HTTP/1.1 keep-alive) */
+#if CONFIG_HTTPS_ENABLE
+    esp_err_t err = httpd_ssl_start(&server, &ssl_config);
+#else
+    esp_err_t err = httpd_start(&server, config);
+#endif
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s server failed to start on port %u", inst->name, inst->port);
+        return NULL;
+    }
+    s_httpd[id] = server;
+    /* Register URI handlers */
+    if (id == HTTPD_API) {
+        httpd_register_uri_handler(server, &uri_get);
+#if CONFIG_DHT_EXPORTERS_ENABLE
+        httpd_register_uri_handler(server, &uri_metrics);
+#endif
+        //httpd_register_uri_handler(server, &uri_post);
+    }
+    router_register(server, id);
+    return server;
+}
+
+/*Time router_lookup for a concrete path of every route in the table, {param} segments filled with "0"*/
+void router_bench(int iterations)
+{
+    const struct api_version *v = &s_api_versions[0];
+    for(size_t i = 0; i < v->count; i++)
+    {
+        char path[64];
+        size_t len = 0;
+        for(const char *p = v->routes[i].pattern; *p && len < sizeof(path) - 2; p++)
+        {
+            if(*p == '{')
+            {
+                path[len++] = '0';
+                p = strchr(p, '}');
+            }
+            else
+            {
+                path[len++] = *p;
+            }
+        }
+        path[len] = 0;
+        struct route_params params;
+        bool wrong_method;
+        const struct route *r = NULL;
+        int64_t start = esp_timer_get_time();
+        for(int j = 0; j < iterations; j++)
+            r = router_lookup(v, v->routes[i].method, path, len, &params, &wrong_method);
+        int64_t elapsed = esp_timer_get_time() - start;
+        printf("route %-20s %s %6lld ns/op\n", path, r == &v->routes[i] ? "ok  " : "MISS", elapsed * 1000 / iterations);
+    }
+}
+
+/* Function for starting the webserver, returns the API instance */
+httpd_handle_t start_webserver(void)
+{
+    qcache_init();
+    router_init();
+#if CONFIG_STREAM_ENABLE
+    stream_start();
+#endif
+    start_instance(HTTPD_BULK);
+    /* If server failed to start, handle will be NULL */
+    return start_instance(HTTPD_API);
+}
+
+int debug_format_httpd(char *out, size_t len)
+{
+    static const char *const names[HTTPD_INSTANCES] = { "api", "bulk" };
+    struct httpd_latency lat[HTTPD_INSTANCES];
+    portENTER_CRITICAL(&s_httpd_latency_mux);
+    memcpy(lat, s_httpd_latency, sizeof(lat));
+    portEXIT_CRITICAL(&s_httpd_latency_mux);
+    int n = 0;
+    APPEND(out, len, n, "{\"bucket_ms\":[1,4,16,64,256,1024]");
+    for(int i = 0; i < HTTPD_INSTANCES; i++)
+    {
+        APPEND(out, len, n, ",\"%s\":{\"requests\":%u,\"avg_us\":%u,\"max_us\":%u,\"buckets\":[", names[i], lat[i].requests,
+               lat[i].requests ? (uint32_t)(lat[i].total_us / lat[i].requests) : 0, lat[i].max_us);
+        for(int b = 0; b < HTTPD_LATENCY_BUCKETS; b++)
+            APPEND(out, len, n, "%s%u", b ? "," : "", lat[i].buckets[b]);
+        APPEND(out, len, n, "]}");
+    }
+    APPEND(out, len, n, "}");
+    return n;
+}
+
+#if CONFIG_HTTPS_ENABLE
+/*Resumption rate and handshake cost, a full handshake costing far more than a resumed one is the point*/
+int debug_format_tls(char *out, size_t len)
+{
+    portENTER_CRITICAL(&s_tls_mux);
+    struct tls_stats st = s_tls_stats;
+    portEXIT_CRITICAL(&s_tls_mux);
+    uint32_t total = st.full + st.resumed;
+    int n = 0;
+    APPEND(out, len, n, "{\"handshakes\":%u,\"full\":%u,\"resumed\":%u,\"failures\":%u,\"resumption_pct\":%u,",
+           total, st.full, st.resumed, st.failures, total ? st.resumed * 100 / total : 0);
+    APPEND(out, len, n, "\"full_avg_us\":%u,\"full_max_us\":%u,\"resumed_avg_us\":%u,\"resumed_max_us\":%u,",
+           st.full ? (uint32_t)(st.full_us / st.full) : 0, st.full_max_us,
+           st.resumed ? (uint32_t)(st.resumed_us / st.resumed) : 0, st.resumed_max_us);
+    APPEND(out, len, n, "\"handshake_ms_total\":%u,\"tickets_issued\":%u,\"tickets_rejected\":%u}",
+           (uint32_t)((st.full_us + st.resumed_us) / 1000), st.tickets_issued, st.tickets_rejected);
+    return n;
+}
+#endif
+/*HTTP Server section END*/
@@ -0,0 +1,52 @@
+/*
+HTTP API: the per-request arena allocator, the API and bulk httpd instances (optionally HTTPS) and the route table.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <esp_http_server.h>
+#include "dht_core.h"
+
+/*Arena section*/
+#define ARENA_BLOCK_SIZE  CONFIG_ARENA_BLOCK_SIZE
+#define ARENA_BLOCKS      CONFIG_ARENA_BLOCKS
+
+struct arena{
+    uint32_t blocks;      //bitmask of pool blocks owned
+    uint8_t *cur;         //current block
+    size_t used;          //bytes used in the current block
+    size_t requested;     //bytes handed out over the arena's lifetime
+};
+
+void arena_setup(void);
+void arena_init(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size);
+void arena_release(struct arena *a);
+void arena_bind_cjson(struct arena *a);
+int debug_format_arena(char *out, size_t len);
+
+/*Query cache section*/
+#if CONFIG_QCACHE_SIZE > 0
+int debug_format_qcache(char *out, size_t len);
+#endif
+
+/*HTTP Server section*/
+#if CONFIG_HTTPS_ENABLE
+#define HTTPD_API_PORT 443
+#else
+#define HTTPD_API_PORT 80
+#endif
+
+enum httpd_instance { HTTPD_API, HTTPD_BULK, HTTPD_INSTANCES };
+
+httpd_handle_t start_webserver(void);
+TaskHandle_t httpd_task(enum httpd_instance id);
+void router_bench(int iterations);
+int debug_format_httpd(char *out, size_t len);
+#if CONFIG_HTTPS_ENABLE
+int debug_format_tls(char *out, size_t len);
+#endif
+#if CONFIG_STREAM_ENABLE
+int debug_format_stream(char *out, size_t len);
+#endif
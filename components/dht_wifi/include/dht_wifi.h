@@ -0,0 +1,17 @@
+/*
+Station mode Wi-Fi, credentials come from the config store.
+*/
+#pragma once
+
+#include "dht_core.h"
+
+/*WIFI setup section*/
+struct wifi_link{
+    bool connected;
+    int8_t rssi;            //dBm of the AP's beacons
+    uint32_t disconnects;   //since boot
+    uint8_t last_reason;    //wifi_err_reason_t of the last one
+};
+
+void wifi_init_sta(void);
+void wifi_link_get(struct wifi_link *out);
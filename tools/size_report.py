@@ -0,0 +1,71 @@
+#!/usr/bin/env python
+"""
+Build the firmware once per profile in profiles/ and print its flash and static RAM footprint.
+
+    python tools/size_report.py               # every profile
+    python tools/size_report.py minimal full  # just these
+
+Each profile is an sdkconfig fragment applied on top of the Kconfig defaults and builds in build/profile-<name>,
+so the regular build directory and sdkconfig are left alone. Needs an ESP-IDF environment (IDF_PATH, idf.py).
+"""
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PROFILE_DIR = os.path.join(ROOT, 'profiles')
+PROFILE_PREFIX = 'sdkconfig.'
+
+
+def profiles():
+    names = [os.path.basename(p)[len(PROFILE_PREFIX):] for p in glob.glob(os.path.join(PROFILE_DIR, PROFILE_PREFIX + '*'))]
+    return sorted(names)
+
+
+def build(name):
+    build_dir = os.path.join(ROOT, 'build', 'profile-' + name)
+    subprocess.check_call(['idf.py', '-B', build_dir,
+                           '-D', 'SDKCONFIG=' + os.path.join(build_dir, 'sdkconfig'),
+                           '-D', 'SDKCONFIG_DEFAULTS=' + os.path.join(PROFILE_DIR, PROFILE_PREFIX + name),
+                           'build'], cwd=ROOT, stdout=subprocess.DEVNULL)
+    maps = glob.glob(os.path.join(build_dir, '*.map'))
+    if not maps:
+        raise RuntimeError('no map file in ' + build_dir)
+    return maps[0]
+
+
+def size(map_file):
+    idf_size = os.path.join(os.environ['IDF_PATH'], 'tools', 'idf_size.py')
+    out = subprocess.check_output([sys.executable, idf_size, '--json', map_file])
+    return json.loads(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('profile', nargs='*', help='profiles to build, default all of profiles/')
+    args = parser.parse_args()
+    if 'IDF_PATH' not in os.environ:
+        sys.exit('IDF_PATH is not set, run from an ESP-IDF shell')
+    names = args.profile or profiles()
+    unknown = [n for n in names if n not in profiles()]
+    if unknown:
+        sys.exit('unknown profile: ' + ', '.join(unknown))
+
+    rows = []
+    for name in names:
+        print('building %s...' % name, file=sys.stderr)
+        s = size(build(name))
+        rows.append((name, s.get('total_size', 0), s.get('used_dram', 0), s.get('used_iram', 0),
+                     s.get('flash_code', 0) + s.get('flash_rodata', 0)))
+
+    print('%-12s %10s %10s %10s %10s' % ('profile', 'image', 'dram', 'iram', 'flash'))
+    for name, total, dram, iram, flash in rows:
+        print('%-12s %10d %10d %10d %10d' % (name, total, dram, iram, flash))
+    print('image is the total size, dram and iram are static use (.data, .bss and code), flash is code plus rodata')
+
+
+if __name__ == '__main__':
+    main()